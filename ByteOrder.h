@@ -0,0 +1,68 @@
+/*
+ * $Id$
+ */
+
+#ifndef BYTEORDER_H
+#define BYTEORDER_H
+
+/*
+ * Big-endian packing for anything the robot writes and a PC reads back:
+ * trace files and the vision stream.  Each call advances the pointer.
+ */
+
+static inline void Put8(unsigned char *&p, unsigned long v)
+{
+	*p++ = (unsigned char)v;
+}
+
+static inline void Put16(unsigned char *&p, unsigned long v)
+{
+	*p++ = (unsigned char)(v >> 8);
+	*p++ = (unsigned char)v;
+}
+
+static inline void Put32(unsigned char *&p, unsigned long v)
+{
+	*p++ = (unsigned char)(v >> 24);
+	*p++ = (unsigned char)(v >> 16);
+	*p++ = (unsigned char)(v >> 8);
+	*p++ = (unsigned char)v;
+}
+
+static inline unsigned long Get8(const unsigned char *&p)
+{
+	return *p++;
+}
+
+static inline unsigned long Get16(const unsigned char *&p)
+{
+	unsigned long v = ((unsigned long)p[0] << 8) | (unsigned long)p[1];
+	p += 2;
+	return v;
+}
+
+static inline unsigned long Get32(const unsigned char *&p)
+{
+	unsigned long v = ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+			((unsigned long)p[2] << 8) | (unsigned long)p[3];
+	p += 4;
+	return v;
+}
+
+// sign-extend values written as two's complement
+static inline long Signed8(unsigned long v)
+{
+	return (v & 0x80UL) ? (long)v - 0x100L : (long)v;
+}
+
+static inline long Signed16(unsigned long v)
+{
+	return (v & 0x8000UL) ? (long)v - 0x10000L : (long)v;
+}
+
+static inline long Signed32(unsigned long v)
+{
+	return (v & 0x80000000UL) ? (long)(v | ~0xffffffffUL) : (long)v;
+}
+
+#endif
@@ -0,0 +1,498 @@
+/*
+ * $Id$
+ */
+
+#ifndef JPEGDECODER_H
+#define JPEGDECODER_H
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+/*
+ * Baseline JPEG decoding at 1/1, 1/2, 1/4 or 1/8 scale.
+ */
+
+static const int JPEG_MAX_COMPONENTS = 3;
+
+/**
+ * Decodes straight into the blue, green, red, alpha pixels the threshold
+ * reads.  At a reduced scale each 8x8 block goes straight to the averages
+ * of the 2x2, 4x4 or 8x8 groups of pixels the full inverse DCT would have
+ * given, so there is no full size transform and no full size image, and
+ * subsampled chroma is decoded at the output's resolution instead of being
+ * stretched to it.  Progressive and arithmetic coded files are turned down
+ * for NI's decoder to handle.
+ */
+class JpegDecoder
+{
+	struct Huffman
+	{
+		unsigned short look[512];      // length << 8 | value for codes of 9 bits or less
+		int minCode[17], maxCode[18], valPtr[17];
+		unsigned char values[256];
+		bool defined;
+	};
+
+	struct Component
+	{
+		int id, h, v, tq, td, ta;
+		int pred;
+		int bw, bh;                    // samples a block decodes to
+		int stride;                    // samples per band row
+		std::vector<unsigned char> band;   // one MCU row, at scale
+		std::vector<int> xmap, ymap;   // band column and row for each output pixel
+	};
+
+	unsigned short qt[4][64];          // in zigzag order, as stored
+	Huffman dc[4], ac[4];
+	Component comp[JPEG_MAX_COMPONENTS];
+	Component *scan[JPEG_MAX_COMPONENTS];
+	int components, scanComponents;
+	int width, height, scale, restartInterval;
+	int hMax, vMax;
+
+	// entropy coded data
+	const unsigned char *p, *end;
+	unsigned bits;                     // next bits, most significant first
+	int bitCount;
+	bool marker;                       // stopped at a marker; feed zeros
+
+	float box[4][8][8];                // [log2 samples][sample][frequency]
+	int crR[256], cbB[256], crG[256], cbG[256];
+
+	static const unsigned char *Zigzag()
+	{
+		static const unsigned char z[64] = {
+			0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+			12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+			35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+			58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+		};
+		return z;
+	}
+
+	static unsigned char Clamp(int v)
+	{
+		return v < 0 ? 0 : v > 255 ? 255 : v;
+	}
+
+	static int Log2(int s)
+	{
+		return s == 8 ? 3 : s == 4 ? 2 : s == 2 ? 1 : 0;
+	}
+
+	void BuildHuffman(Huffman &h, const unsigned char *counts, const unsigned char *values, int n)
+	{
+		int code = 0, k = 0;
+		memset(h.look, 0, sizeof(h.look));
+		memcpy(h.values, values, n);
+		for(int len = 1; len <= 16; len++)
+		{
+			h.valPtr[len] = k;
+			h.minCode[len] = code;
+			for(int i = 0; i < counts[len - 1]; i++, k++, code++)
+			{
+				if(len <= 9)
+				{
+					int first = code << (9 - len);
+					for(int j = 0; j < 1 << (9 - len); j++)
+						h.look[first + j] = len << 8 | values[k];
+				}
+			}
+			h.maxCode[len] = counts[len - 1] ? code - 1 : -1;
+			code <<= 1;
+		}
+		h.maxCode[17] = 0x7fffffff;
+		h.defined = true;
+	}
+
+	void Fill()
+	{
+		while(bitCount <= 24)
+		{
+			unsigned b = 0;
+			if(!marker && p < end)
+			{
+				b = *p++;
+				if(b == 0xff)
+				{
+					if(p < end && *p == 0)
+					{
+						p++;
+					}
+					else
+					{
+						p--;
+						b = 0;
+						marker = true;
+					}
+				}
+			}
+			bits |= b << (24 - bitCount);
+			bitCount += 8;
+		}
+	}
+
+	int Symbol(const Huffman &h)
+	{
+		Fill();
+		int e = h.look[bits >> 23];
+		if(e)
+		{
+			bits <<= e >> 8;
+			bitCount -= e >> 8;
+			return e & 0xff;
+		}
+		for(int len = 10; len <= 16; len++)
+		{
+			int code = bits >> (32 - len);
+			if(code <= h.maxCode[len])
+			{
+				bits <<= len;
+				bitCount -= len;
+				return h.values[h.valPtr[len] + code - h.minCode[len]];
+			}
+		}
+		return -1;
+	}
+
+	int Receive(int s)
+	{
+		if(!s)
+			return 0;
+		Fill();
+		int v = bits >> (32 - s);
+		bits <<= s;
+		bitCount -= s;
+		return v < 1 << (s - 1) ? v - (1 << s) + 1 : v;
+	}
+
+	/**
+	 * Decode one block and transform it into c.bw x c.bh samples, each the
+	 * average of the pixels it covers.  Only the rows and columns of
+	 * coefficients up to the last nonzero one cost anything.
+	 */
+	bool Block(Component &c, unsigned char *out)
+	{
+		const unsigned char *zz = Zigzag();
+		const unsigned short *q = qt[c.tq];
+		int f[64];
+		int maxU = 0, maxV = 0;
+		int t = Symbol(dc[c.td]);
+		if(t < 0 || t > 11)
+			return false;
+		c.pred += Receive(t);
+		memset(f, 0, sizeof(f));
+		f[0] = c.pred * q[0];
+		for(int k = 1; k < 64; k++)
+		{
+			int rs = Symbol(ac[c.ta]);
+			if(rs < 0)
+				return false;
+			if(!(rs & 15))
+			{
+				if(rs != 0xf0)
+					break;
+				k += 15;
+				continue;
+			}
+			k += rs >> 4;
+			if(k > 63)
+				return false;
+			int n = zz[k], val = Receive(rs & 15);
+			f[n] = val * q[k];
+			if(val)
+			{
+				maxU = (n & 7) > maxU ? n & 7 : maxU;
+				maxV = n >> 3 > maxV ? n >> 3 : maxV;
+			}
+		}
+
+		// the DC alone is a flat block
+		if(!maxU && !maxV)
+		{
+			unsigned char s = Clamp((f[0] + 4 * (f[0] >= 0 ? 1 : -1)) / 8 + 128);
+			for(int y = 0; y < c.bh; y++)
+				memset(out + y * c.stride, s, c.bw);
+			return true;
+		}
+		const float (*bx)[8] = box[Log2(c.bw)], (*by)[8] = box[Log2(c.bh)];
+		float g[8][8];
+		for(int y = 0; y < c.bh; y++)
+		{
+			for(int u = 0; u <= maxU; u++)
+			{
+				float sum = 0;
+				for(int v = 0; v <= maxV; v++)
+					sum += by[y][v] * f[v * 8 + u];
+				g[y][u] = sum;
+			}
+		}
+		for(int y = 0; y < c.bh; y++)
+		{
+			for(int x = 0; x < c.bw; x++)
+			{
+				float sum = 128.5f;
+				for(int u = 0; u <= maxU; u++)
+					sum += bx[x][u] * g[y][u];
+				out[y * c.stride + x] = Clamp((int)floorf(sum));
+			}
+		}
+		return true;
+	}
+
+	// after a restart marker, start the prediction and bits over
+	bool Restart()
+	{
+		bits = 0;
+		bitCount = 0;
+		if(marker && p + 1 < end && p[1] >= 0xd0 && p[1] <= 0xd7)
+			p += 2;
+		else
+			return false;
+		marker = false;
+		for(int i = 0; i < components; i++)
+			comp[i].pred = 0;
+		return true;
+	}
+
+	// one band of output rows from the components' band buffers
+	void Convert(int row, int rows, unsigned char *out, int pitch, int outWidth)
+	{
+		for(int y = 0; y < rows; y++)
+		{
+			unsigned char *o = out + (row + y) * pitch * 4;
+			const unsigned char *py = &comp[0].band[comp[0].ymap[y] * comp[0].stride];
+			const int *xy = &comp[0].xmap[0];
+			if(components == 1)
+			{
+				for(int x = 0; x < outWidth; x++, o += 4)
+				{
+					o[0] = o[1] = o[2] = py[xy[x]];
+					o[3] = 0;
+				}
+				continue;
+			}
+			const unsigned char *pb = &comp[1].band[comp[1].ymap[y] * comp[1].stride];
+			const unsigned char *pr = &comp[2].band[comp[2].ymap[y] * comp[2].stride];
+			const int *xb = &comp[1].xmap[0], *xr = &comp[2].xmap[0];
+			for(int x = 0; x < outWidth; x++, o += 4)
+			{
+				int l = py[xy[x]], cb = pb[xb[x]], cr = pr[xr[x]];
+				o[0] = Clamp(l + cbB[cb]);
+				o[1] = Clamp(l + ((cbG[cb] + crG[cr]) >> 16));
+				o[2] = Clamp(l + crR[cr]);
+				o[3] = 0;
+			}
+		}
+	}
+
+public:
+	JpegDecoder(): components(0), scanComponents(0), width(0), height(0), scale(1), restartInterval(0)
+	{
+		// the inverse DCT's basis averaged over groups of 8 / n pixels
+		for(int l = 0; l < 4; l++)
+		{
+			int n = 1 << l, k = 8 / n;
+			for(int x = 0; x < n; x++)
+			{
+				for(int u = 0; u < 8; u++)
+				{
+					double sum = 0;
+					for(int i = x * k; i < x * k + k; i++)
+						sum += (u ? 0.5 : 0.5 / sqrt(2.0)) * cos((2 * i + 1) * u * 3.141592653589 / 16);
+					box[l][x][u] = (float)(sum / k);
+				}
+			}
+		}
+		for(int i = 0; i < 256; i++)
+		{
+			crR[i] = (int)floor(1.402 * (i - 128) + 0.5);
+			cbB[i] = (int)floor(1.772 * (i - 128) + 0.5);
+			crG[i] = -(int)(0.714136 * 65536) * (i - 128);
+			cbG[i] = -(int)(0.344136 * 65536) * (i - 128) + 32768;
+		}
+	}
+
+	/**
+	 * Read the headers up to the start of the scan.  Returns false for
+	 * anything but a single scan baseline file.  Width and height are the
+	 * size decoded at 1/scale, where scale is 1, 2, 4 or 8.
+	 */
+	bool Start(const char *jpeg, int len, int scale, int &outWidth, int &outHeight)
+	{
+		const unsigned char *d = (const unsigned char *)jpeg;
+		int i = 2;
+		bool frame = false;
+		if(len < 4 || d[0] != 0xff || d[1] != 0xd8 || (scale != 1 && scale != 2 && scale != 4 && scale != 8))
+			return false;
+		this->scale = scale;
+		restartInterval = 0;
+		for(int t = 0; t < 4; t++)
+			dc[t].defined = ac[t].defined = false;
+		while(i + 4 <= len)
+		{
+			int m, segment;
+			const unsigned char *s;
+			if(d[i] != 0xff)
+				return false;
+			m = d[i + 1];
+			if(m == 0xff)
+			{
+				i++;
+				continue;
+			}
+			segment = (d[i + 2] << 8) | d[i + 3];
+			s = d + i + 4;
+			if(i + 2 + segment > len || segment < 2)
+				return false;
+			if(m == 0xc0 || m == 0xc1)
+			{
+				if(s[0] != 8)
+					return false;
+				height = (s[1] << 8) | s[2];
+				width = (s[3] << 8) | s[4];
+				components = s[5];
+				if(!width || !height || (components != 1 && components != 3))
+					return false;
+				hMax = vMax = 1;
+				for(int c = 0; c < components; c++)
+				{
+					comp[c].id = s[6 + c * 3];
+					comp[c].h = components == 1 ? 1 : s[7 + c * 3] >> 4;
+					comp[c].v = components == 1 ? 1 : s[7 + c * 3] & 15;
+					comp[c].tq = s[8 + c * 3] & 3;
+					if(comp[c].h < 1 || comp[c].h > 2 || comp[c].v < 1 || comp[c].v > 2)
+						return false;
+					hMax = comp[c].h > hMax ? comp[c].h : hMax;
+					vMax = comp[c].v > vMax ? comp[c].v : vMax;
+				}
+				frame = true;
+			}
+			else if(m >= 0xc2 && m <= 0xcf && m != 0xc4 && m != 0xc8 && m != 0xcc)
+			{
+				return false;
+			}
+			else if(m == 0xc4)
+			{
+				const unsigned char *e = s + segment - 2;
+				while(s + 17 <= e)
+				{
+					int n = 0;
+					for(int k = 0; k < 16; k++)
+						n += s[1 + k];
+					if(s + 17 + n > e || n > 256 || (s[0] & 15) > 3)
+						return false;
+					BuildHuffman(s[0] >> 4 ? ac[s[0] & 3] : dc[s[0] & 3], s + 1, s + 17, n);
+					s += 17 + n;
+				}
+			}
+			else if(m == 0xdb)
+			{
+				const unsigned char *e = s + segment - 2;
+				while(s < e)
+				{
+					int wide = s[0] >> 4, t = s[0] & 3;
+					if(s + 1 + 64 * (wide + 1) > e)
+						return false;
+					for(int k = 0; k < 64; k++)
+						qt[t][k] = wide ? (s[1 + 2 * k] << 8) | s[2 + 2 * k] : s[1 + k];
+					s += 1 + 64 * (wide + 1);
+				}
+			}
+			else if(m == 0xdd)
+			{
+				restartInterval = (s[0] << 8) | s[1];
+			}
+			else if(m == 0xda)
+			{
+				if(!frame)
+					return false;
+				scanComponents = s[0];
+				if(scanComponents != components)
+					return false;
+				for(int k = 0; k < scanComponents; k++)
+				{
+					int c;
+					for(c = 0; c < components && comp[c].id != s[1 + k * 2]; c++);
+					if(c == components)
+						return false;
+					comp[c].td = s[2 + k * 2] >> 4 & 3;
+					comp[c].ta = s[2 + k * 2] & 3;
+					if(!dc[comp[c].td].defined || !ac[comp[c].ta].defined)
+						return false;
+					scan[k] = &comp[c];
+				}
+				p = d + i + 2 + segment;
+				end = d + len;
+				outWidth = (width + scale - 1) / scale;
+				outHeight = (height + scale - 1) / scale;
+				return true;
+			}
+			else if(m == 0xd9)
+			{
+				return false;
+			}
+			i += 2 + segment;
+		}
+		return false;
+	}
+
+	/**
+	 * Decode the scan Start() found into rows of four byte pixels, blue,
+	 * green, red and a zero, pitch pixels apart.
+	 */
+	bool Decode(unsigned char *out, int pitch)
+	{
+		int bs = 8 / scale;
+		int mcuWidth = 8 * hMax, mcuHeight = 8 * vMax;
+		int mcusX = (width + mcuWidth - 1) / mcuWidth, mcusY = (height + mcuHeight - 1) / mcuHeight;
+		int outWidth = (width + scale - 1) / scale, outHeight = (height + scale - 1) / scale;
+		int bandRows = vMax * bs;
+		int mcu = 0;
+
+		// subsampled components get bigger blocks, up to 8x8, to land on
+		// the output's own pixels
+		for(int c = 0; c < components; c++)
+		{
+			Component &k = comp[c];
+			k.pred = 0;
+			k.bw = bs * hMax / k.h < 8 ? bs * hMax / k.h : 8;
+			k.bh = bs * vMax / k.v < 8 ? bs * vMax / k.v : 8;
+			k.stride = mcusX * k.h * k.bw;
+			k.band.resize(k.stride * k.v * k.bh);
+			k.xmap.resize(outWidth);
+			k.ymap.resize(bandRows);
+			for(int x = 0; x < outWidth; x++)
+				k.xmap[x] = x * k.h * k.bw / (hMax * bs);
+			for(int y = 0; y < bandRows; y++)
+				k.ymap[y] = y * k.v * k.bh / bandRows;
+		}
+		bits = 0;
+		bitCount = 0;
+		marker = false;
+
+		for(int my = 0; my < mcusY; my++)
+		{
+			for(int mx = 0; mx < mcusX; mx++, mcu++)
+			{
+				if(restartInterval && mcu && mcu % restartInterval == 0 && !Restart())
+					return false;
+				for(int s = 0; s < scanComponents; s++)
+				{
+					Component &k = *scan[s];
+					for(int by = 0; by < k.v; by++)
+						for(int bx = 0; bx < k.h; bx++)
+							if(!Block(k, &k.band[by * k.bh * k.stride + (mx * k.h + bx) * k.bw]))
+								return false;
+				}
+			}
+			int rows = outHeight - my * bandRows;
+			Convert(my * bandRows, rows < bandRows ? rows : bandRows, out, pitch, outWidth);
+		}
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,325 @@
+/*
+ * $Id$
+ */
+
+#ifndef LOGBUFFER_H
+#define LOGBUFFER_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Console logging kept out of the fast loops.
+ */
+
+static const int LOG_RING_SIZE = 128;      // records per task
+static const int LOG_MAX_RINGS = 16;       // task names that can log
+static const int LOG_MAX_SITES = 64;
+static const int LOG_MAX_ARGS = 8;
+static const int LOG_LINE = 256;
+static const int LOG_NAME = 32;            // characters of a task name kept
+
+// the record has to be in memory before the index that publishes it.  The
+// cRIO has a single core, so keeping the compiler from reordering is enough
+#ifdef __vxworks
+#define LOG_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define LOG_BARRIER() __sync_synchronize()
+#endif
+
+/**
+ * A line in the code that logs: its printf format, without the newline,
+ * and the least time between two of its lines, or 0 for no limit.  %s
+ * arguments are kept as pointers, so they have to outlive the record;
+ * literals and camera or host names do.
+ */
+struct LogSite
+{
+	const char *format;
+	double interval;
+};
+
+union LogArg
+{
+	long i;
+	double d;
+	const char *s;
+};
+
+struct LogRecord
+{
+	int site;
+	int held;                  // lines from the site rate limited since the last one out
+	int lost;                  // and lost to a full ring
+	double time;
+	LogArg args[LOG_MAX_ARGS];
+};
+
+/**
+ * One task's records.  Only that task writes and only the log task reads,
+ * so the two indexes are all the locking there is.  A ring belongs to a
+ * task name, so a Task started again, which is a new task, picks up where
+ * its last run left off instead of taking another ring.
+ */
+struct LogRing
+{
+	volatile long owner;       // the task now writing under the name
+	char name[LOG_NAME];
+	volatile unsigned head;    // written by the owner
+	volatile unsigned tail;    // written by the log task
+	volatile unsigned lost;
+	unsigned reported;         // lost as of the last report, log task only
+	double last[LOG_MAX_SITES];
+	int held[LOG_MAX_SITES];
+	int siteLost[LOG_MAX_SITES];
+	LogRecord records[LOG_RING_SIZE];
+};
+
+/**
+ * A caller copies a site number and its raw arguments into its own task's
+ * ring, which is a few stores; a low priority task formats the records
+ * later and does the slow console write.  A site can be held to one line
+ * per interval, and lines held back or lost to a full ring are counted
+ * against their site and reported on the next line from it that gets out.
+ */
+class LogBuffer
+{
+	const LogSite *sites;
+	int siteCount;
+	char types[LOG_MAX_SITES][LOG_MAX_ARGS + 1];
+	LogRing rings[LOG_MAX_RINGS];
+	volatile int ringCount;
+	volatile unsigned unclaimed;   // records from tasks that found every ring taken
+	unsigned unclaimedReported;    // log task only
+
+	/**
+	 * Step past the conversion after a '%' and return what it takes: 'i'
+	 * for int, 'l' for long, 'd' for double, 's' for a pointer or '%' for
+	 * none.
+	 */
+	static char Conversion(const char *&p)
+	{
+		bool isLong = false;
+		while(*p && strchr("-+ #0123456789.", *p))
+			p++;
+		while(*p == 'l' || *p == 'h')
+			isLong |= *p++ == 'l';
+		switch(*p ? *p++ : '%')
+		{
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+			return isLong ? 'l' : 'i';
+		case 'e': case 'E': case 'f': case 'g': case 'G':
+			return 'd';
+		case 's': case 'p':
+			return 's';
+		default:
+			return '%';
+		}
+	}
+
+	int Format(const LogRecord &r, char *line, int size) const
+	{
+		const char *p = sites[r.site].format;
+		const char *t = types[r.site];
+		int n = snprintf(line, size, "%8.3f ", r.time);
+		while(*p && n < size - 1)
+		{
+			const char *start = p;
+			char spec[16];
+			char type;
+			int len, k;
+			if(*p != '%')
+			{
+				line[n++] = *p++;
+				continue;
+			}
+			type = Conversion(++p);
+			if(type == '%' || !*t)
+			{
+				line[n++] = type == '%' ? '%' : '?';
+				continue;
+			}
+			len = p - start < (int)sizeof(spec) - 1 ? p - start : sizeof(spec) - 1;
+			memcpy(spec, start, len);
+			spec[len] = 0;
+			const LogArg &a = r.args[t - types[r.site]];
+			switch(*t++)
+			{
+			case 'i': k = snprintf(line + n, size - n, spec, (int)a.i); break;
+			case 'l': k = snprintf(line + n, size - n, spec, a.i); break;
+			case 'd': k = snprintf(line + n, size - n, spec, a.d); break;
+			default: k = snprintf(line + n, size - n, spec, a.s); break;
+			}
+			n += k < size - n ? k : size - n - 1;
+		}
+		line[n] = 0;
+		if(r.held || r.lost)
+			n += snprintf(line + n, size - n, " (%d more held back, %d lost)", r.held, r.lost);
+		return n < size ? n : size - 1;
+	}
+
+public:
+	LogBuffer(const LogSite *sites, int count):
+		sites(sites),
+		siteCount(count < LOG_MAX_SITES ? count : LOG_MAX_SITES),
+		ringCount(0),
+		unclaimed(0),
+		unclaimedReported(0)
+	{
+		for(int s = 0; s < siteCount; s++)
+		{
+			const char *p = sites[s].format;
+			int n = 0;
+			while((p = strchr(p, '%')) != NULL)
+			{
+				char type = Conversion(++p);
+				if(type != '%' && n < LOG_MAX_ARGS)
+					types[s][n++] = type;
+			}
+			types[s][n] = 0;
+		}
+	}
+
+	/**
+	 * The ring owner has claimed, if any.  Safe from any task.
+	 */
+	LogRing *Find(long owner)
+	{
+		int n = ringCount;
+		for(int i = 0; i < n; i++)
+			if(rings[i].owner == owner)
+				return &rings[i];
+		return 0;
+	}
+
+	/**
+	 * Give owner the ring for its name, taking it over from an earlier task
+	 * of that name, or a new one.  Tasks sharing a name must not log at the
+	 * same time.  Callers must take turns; returns NULL, and counts the line
+	 * as lost, once every ring is taken.
+	 */
+	LogRing *Claim(long owner, const char *name)
+	{
+		LogRing *ring = Find(owner);
+		if(ring)
+			return ring;
+		if(!name)
+			name = "";
+		for(int i = 0; i < ringCount; i++)
+		{
+			if(!strncmp(rings[i].name, name, LOG_NAME - 1))
+			{
+				rings[i].owner = owner;
+				return &rings[i];
+			}
+		}
+		if(ringCount == LOG_MAX_RINGS)
+		{
+			unclaimed++;
+			return 0;
+		}
+		ring = &rings[ringCount];
+		ring->owner = owner;
+		strncpy(ring->name, name, LOG_NAME - 1);
+		ring->name[LOG_NAME - 1] = 0;
+		ring->head = ring->tail = 0;
+		ring->lost = ring->reported = 0;
+		for(int s = 0; s < LOG_MAX_SITES; s++)
+		{
+			ring->last[s] = -1e9;
+			ring->held[s] = ring->siteLost[s] = 0;
+		}
+		LOG_BARRIER();
+		ringCount++;
+		return ring;
+	}
+
+	/**
+	 * Queue a line from site with its arguments, unless the site is being
+	 * rate limited or the ring is full.  Only the ring's owner may call it.
+	 */
+	void Write(LogRing *ring, int site, double now, va_list ap)
+	{
+		unsigned head = ring->head;
+		if(site < 0 || site >= siteCount)
+			return;
+		if(now - ring->last[site] < sites[site].interval)
+		{
+			ring->held[site]++;
+			return;
+		}
+		if(head - ring->tail >= (unsigned)LOG_RING_SIZE)
+		{
+			ring->siteLost[site]++;
+			ring->lost++;
+			return;
+		}
+		LogRecord &r = ring->records[head % LOG_RING_SIZE];
+		r.site = site;
+		r.time = now;
+		r.held = ring->held[site];
+		r.lost = ring->siteLost[site];
+		for(int i = 0; types[site][i]; i++)
+		{
+			switch(types[site][i])
+			{
+			case 'i': r.args[i].i = va_arg(ap, int); break;
+			case 'l': r.args[i].i = va_arg(ap, long); break;
+			case 'd': r.args[i].d = va_arg(ap, double); break;
+			default: r.args[i].s = va_arg(ap, const char *); break;
+			}
+		}
+		ring->held[site] = ring->siteLost[site] = 0;
+		ring->last[site] = now;
+		LOG_BARRIER();
+		ring->head = head + 1;
+	}
+
+	/**
+	 * Format and write out up to max records, oldest first across all the
+	 * rings, along with any losses not yet reported.  Log task only.
+	 * Returns how many records it wrote.
+	 */
+	int Drain(FILE *out, int max)
+	{
+		char line[LOG_LINE];
+		int n = ringCount, done = 0;
+		for(int i = 0; i < n; i++)
+		{
+			unsigned lost = rings[i].lost;
+			if(lost != rings[i].reported)
+			{
+				fprintf(out, "LogBuffer: %u lines lost from %s\n", lost - rings[i].reported, rings[i].name);
+				rings[i].reported = lost;
+			}
+		}
+		if(unclaimed != unclaimedReported)
+		{
+			fprintf(out, "LogBuffer: %u lines lost, no ring free\n", unclaimed - unclaimedReported);
+			unclaimedReported = unclaimed;
+		}
+		while(done < max)
+		{
+			LogRing *oldest = 0;
+			for(int i = 0; i < n; i++)
+			{
+				LogRing &ring = rings[i];
+				if(ring.tail != ring.head && (!oldest ||
+						ring.records[ring.tail % LOG_RING_SIZE].time < oldest->records[oldest->tail % LOG_RING_SIZE].time))
+					oldest = &ring;
+			}
+			if(!oldest)
+				break;
+			LOG_BARRIER();
+			Format(oldest->records[oldest->tail % LOG_RING_SIZE], line, sizeof(line));
+			LOG_BARRIER();
+			oldest->tail++;
+			fprintf(out, "%s\n", line);
+			done++;
+		}
+		return done;
+	}
+};
+
+#endif
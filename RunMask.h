@@ -0,0 +1,394 @@
+/*
+ * $Id$
+ */
+
+#ifndef RUNMASK_H
+#define RUNMASK_H
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+/*
+ * Run length binary masks for the vision pipeline.
+ */
+
+/**
+ * Set pixels x0 up to but not including x1.
+ */
+struct Run
+{
+	int x0, x1;
+};
+
+/**
+ * One connected particle.  Bounds are inclusive.
+ */
+struct MaskParticle
+{
+	long area;
+	double sumX, sumY;
+	int left, top, right, bottom;
+
+	double CenterX() const { return sumX / area; }
+	double CenterY() const { return sumY / area; }
+	int Width() const { return right - left + 1; }
+	int Height() const { return bottom - top + 1; }
+
+	// largest first, like GetOrderedParticleAnalysisReports
+	bool operator<(const MaskParticle &p) const { return area > p.area; }
+};
+
+/**
+ * A binary mask kept as runs of set pixels, row by row.  The tape is a
+ * small part of the frame, so every step after the threshold costs in
+ * proportion to the target instead of the image.  The operations follow
+ * the BinaryImage calls they replace.
+ */
+class RunMask
+{
+	std::vector<Run> runs;
+	std::vector<int> rows;              // row y is runs[rows[y]] up to runs[rows[y + 1]]
+	int width;
+
+	// scratch, kept to save allocating every frame
+	mutable std::vector<int> parent;
+	mutable std::vector<int> label;
+	mutable std::vector<int> runRow;
+
+	struct Span
+	{
+		int y, x0, x1;
+		bool operator<(const Span &s) const { return y < s.y || (y == s.y && x0 < s.x0); }
+	};
+
+	struct Point
+	{
+		int x, y;
+		bool operator<(const Point &p) const { return x < p.x || (x == p.x && y < p.y); }
+	};
+
+	static bool Touch(const Run &a, const Run &b, bool connectivity8)
+	{
+		return connectivity8 ? a.x0 <= b.x1 && b.x0 <= a.x1 : a.x0 < b.x1 && b.x0 < a.x1;
+	}
+
+	int Find(int i) const
+	{
+		while(parent[i] != i)
+			i = parent[i] = parent[parent[i]];
+		return i;
+	}
+
+	/**
+	 * Number the particles top to bottom and give each run its particle.
+	 */
+	int Label(bool connectivity8) const
+	{
+		int n = runs.size(), particles = 0;
+		parent.resize(n);
+		label.resize(n);
+		runRow.resize(n);
+		for(int i = 0; i < n; i++)
+			parent[i] = i;
+		for(int y = 0; y < Height(); y++)
+		{
+			for(int i = rows[y]; i < rows[y + 1]; i++)
+				runRow[i] = y;
+			if(!y)
+				continue;
+			int i = rows[y - 1], j = rows[y];
+			while(i < rows[y] && j < rows[y + 1])
+			{
+				if(Touch(runs[i], runs[j], connectivity8))
+				{
+					int a = Find(i), b = Find(j);
+					if(a != b)
+						parent[a > b ? a : b] = a < b ? a : b;
+				}
+				if(runs[i].x1 < runs[j].x1)
+					i++;
+				else
+					j++;
+			}
+		}
+		// roots always come before the runs joined to them
+		for(int i = 0; i < n; i++)
+			label[i] = Find(i) == i ? particles++ : label[Find(i)];
+		return particles;
+	}
+
+	// rebuild from spans, merging any that overlap or touch in a row
+	void FromSpans(std::vector<Span> &spans, int w, int h)
+	{
+		std::sort(spans.begin(), spans.end());
+		Reset(w, h);
+		unsigned k = 0;
+		for(int y = 0; y < h; y++)
+		{
+			while(k < spans.size() && spans[k].y == y)
+			{
+				Run r = {spans[k].x0, spans[k].x1};
+				for(k++; k < spans.size() && spans[k].y == y && spans[k].x0 <= r.x1; k++)
+					r.x1 = std::max(r.x1, spans[k].x1);
+				Add(r.x0, r.x1);
+			}
+			EndRow();
+		}
+	}
+
+	// keep the runs of the particles marked in keep
+	void Keep(const RunMask &in, const std::vector<bool> &keep)
+	{
+		Reset(in.width, in.Height());
+		for(int y = 0; y < in.Height(); y++)
+		{
+			for(int i = in.rows[y]; i < in.rows[y + 1]; i++)
+				if(keep[in.label[i]])
+					runs.push_back(in.runs[i]);
+			EndRow();
+		}
+	}
+
+	static double Cross(const Point &o, const Point &a, const Point &b)
+	{
+		return (double)(a.x - o.x) * (b.y - o.y) - (double)(a.y - o.y) * (b.x - o.x);
+	}
+
+public:
+	RunMask(): width(0)
+	{
+		rows.push_back(0);
+	}
+
+	void Reset(int w, int h)
+	{
+		width = w;
+		runs.clear();
+		rows.clear();
+		rows.reserve(h + 1);
+		rows.push_back(0);
+	}
+
+	/**
+	 * Build a mask a row at a time: Add() each run left to right, then
+	 * EndRow().
+	 */
+	void Add(int x0, int x1)
+	{
+		Run r = {x0, x1};
+		runs.push_back(r);
+	}
+
+	void EndRow()
+	{
+		rows.push_back(runs.size());
+	}
+
+	int Width() const { return width; }
+	int Height() const { return rows.size() - 1; }
+	int Runs() const { return runs.size(); }
+
+	const Run *Row(int y, int &n) const
+	{
+		n = rows[y + 1] - rows[y];
+		return &runs[0] + rows[y];
+	}
+
+	/**
+	 * Fill each particle out to its convex hull.  Hulls that end up
+	 * touching become one particle, as they would in an image.
+	 */
+	void ConvexHull(RunMask &out, bool connectivity8) const
+	{
+		int particles = Label(connectivity8);
+		std::vector<std::vector<Point> > points(particles);
+		std::vector<Span> spans;
+		for(int i = 0; i < (int)runs.size(); i++)
+		{
+			Point a = {runs[i].x0, runRow[i]}, b = {runs[i].x1 - 1, runRow[i]};
+			points[label[i]].push_back(a);
+			if(b.x != a.x)
+				points[label[i]].push_back(b);
+		}
+		for(int p = 0; p < particles; p++)
+		{
+			std::vector<Point> &pts = points[p];
+			std::vector<Point> hull(2 * pts.size());
+			int k = 0, top = pts[0].y, bottom = pts[0].y;
+
+			// monotone chain
+			std::sort(pts.begin(), pts.end());
+			for(unsigned i = 0; i < pts.size(); i++)
+			{
+				while(k >= 2 && Cross(hull[k - 2], hull[k - 1], pts[i]) <= 0)
+					k--;
+				hull[k++] = pts[i];
+				top = std::min(top, pts[i].y);
+				bottom = std::max(bottom, pts[i].y);
+			}
+			for(int i = pts.size() - 2, t = k + 1; i >= 0; i--)
+			{
+				while(k >= t && Cross(hull[k - 2], hull[k - 1], pts[i]) <= 0)
+					k--;
+				hull[k++] = pts[i];
+			}
+			if(k > 1)
+				k--;
+
+			// every pixel center inside the hull, row by row
+			for(int y = top; y <= bottom; y++)
+			{
+				double lo = width, hi = -1;
+				for(int e = 0; e < k; e++)
+				{
+					const Point &a = hull[e], &b = hull[(e + 1) % k];
+					if(y < std::min(a.y, b.y) || y > std::max(a.y, b.y))
+						continue;
+					if(a.y == b.y)
+					{
+						lo = std::min(lo, (double)std::min(a.x, b.x));
+						hi = std::max(hi, (double)std::max(a.x, b.x));
+					}
+					else
+					{
+						double x = a.x + (double)(y - a.y) * (b.x - a.x) / (b.y - a.y);
+						lo = std::min(lo, x);
+						hi = std::max(hi, x);
+					}
+				}
+				Span s = {y, (int)ceil(lo - 1e-9), (int)floor(hi + 1e-9) + 1};
+				if(s.x1 > s.x0)
+					spans.push_back(s);
+			}
+		}
+		out.FromSpans(spans, width, Height());
+	}
+
+	/**
+	 * Keep the particles whose bounding box is within the given size.
+	 */
+	void ParticleFilter(RunMask &out, int minWidth, int maxWidth, int minHeight, int maxHeight,
+			bool connectivity8) const
+	{
+		std::vector<MaskParticle> particles;
+		GetParticles(particles, connectivity8, false);
+		std::vector<bool> keep(particles.size());
+		for(unsigned p = 0; p < particles.size(); p++)
+		{
+			int w = particles[p].Width(), h = particles[p].Height();
+			keep[p] = w >= minWidth && w <= maxWidth && h >= minHeight && h <= maxHeight;
+		}
+		out.Keep(*this, keep);
+	}
+
+	/**
+	 * Erode by a 3x3 square: a pixel stays if it and all eight neighbors
+	 * are set.  Off the edge counts as clear.
+	 */
+	void Erode(RunMask &out) const
+	{
+		std::vector<Run> a, b;
+		out.Reset(width, Height());
+		for(int y = 0; y < Height(); y++)
+		{
+			a.clear();
+			if(y > 0 && y < Height() - 1)
+			{
+				// shrink each row by a pixel at each end, then intersect the three
+				for(int i = rows[y]; i < rows[y + 1]; i++)
+				{
+					Run r = {runs[i].x0 + 1, runs[i].x1 - 1};
+					if(r.x1 > r.x0)
+						a.push_back(r);
+				}
+				for(int dy = -1; dy <= 1; dy += 2)
+				{
+					int i = 0, j = rows[y + dy];
+					b.clear();
+					while(i < (int)a.size() && j < rows[y + dy + 1])
+					{
+						Run r = {std::max(a[i].x0, runs[j].x0 + 1), std::min(a[i].x1, runs[j].x1 - 1)};
+						if(r.x1 > r.x0)
+							b.push_back(r);
+						if(a[i].x1 < runs[j].x1 - 1)
+							i++;
+						else
+							j++;
+					}
+					a.swap(b);
+				}
+			}
+			for(unsigned i = 0; i < a.size(); i++)
+				out.Add(a[i].x0, a[i].x1);
+			out.EndRow();
+		}
+	}
+
+	/**
+	 * Drop the particles that don't survive the given number of erosions,
+	 * keeping the survivors whole.
+	 */
+	void RemoveSmallObjects(RunMask &out, bool connectivity8, int erosions) const
+	{
+		RunMask eroded, next;
+		int particles = Label(connectivity8);
+		std::vector<bool> keep(particles, false);
+		Erode(eroded);
+		for(int e = 1; e < erosions; e++)
+		{
+			eroded.Erode(next);
+			std::swap(eroded.runs, next.runs);
+			std::swap(eroded.rows, next.rows);
+		}
+		for(int y = 0; y < Height(); y++)
+		{
+			int i = rows[y], j = eroded.rows[y];
+			while(i < rows[y + 1] && j < eroded.rows[y + 1])
+			{
+				if(Touch(runs[i], eroded.runs[j], false))
+					keep[label[i]] = true;
+				if(runs[i].x1 < eroded.runs[j].x1)
+					i++;
+				else
+					j++;
+			}
+		}
+		out.Keep(*this, keep);
+	}
+
+	/**
+	 * Area, center of mass and bounding box of every particle, largest
+	 * first when ordered.
+	 */
+	void GetParticles(std::vector<MaskParticle> &out, bool connectivity8, bool ordered = true) const
+	{
+		int particles = Label(connectivity8);
+		out.resize(particles);
+		for(int p = 0; p < particles; p++)
+		{
+			MaskParticle &m = out[p];
+			m.area = 0;
+			m.sumX = m.sumY = 0;
+			m.left = width;
+			m.top = Height();
+			m.right = m.bottom = -1;
+		}
+		for(int i = 0; i < (int)runs.size(); i++)
+		{
+			MaskParticle &m = out[label[i]];
+			int len = runs[i].x1 - runs[i].x0;
+			m.area += len;
+			m.sumX += (runs[i].x0 + runs[i].x1 - 1) * 0.5 * len;
+			m.sumY += (double)runRow[i] * len;
+			m.left = std::min(m.left, runs[i].x0);
+			m.right = std::max(m.right, runs[i].x1 - 1);
+			m.top = std::min(m.top, runRow[i]);
+			m.bottom = std::max(m.bottom, runRow[i]);
+		}
+		if(ordered)
+			std::stable_sort(out.begin(), out.end());
+	}
+};
+
+#endif
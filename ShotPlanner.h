@@ -0,0 +1,266 @@
+/*
+ * $Id$
+ */
+
+#ifndef SHOTPLANNER_H
+#define SHOTPLANNER_H
+
+#include <stdio.h>
+
+/*
+ * Picks the arm tension for a shot from the distance vision reports.
+ */
+
+// constants
+static const double SHOT_TABLE_MIN = 6.0;       // feet
+static const double SHOT_TABLE_STEP = 1.0;
+static const int SHOT_TABLE_SIZE = 15;          // 6 to 20 feet
+static const double SHOT_LEARN_RATE = 0.5;      // share of the error taken up per shot
+static const int SHOT_CORRECTION = 10;          // counts a short or long shot is taken to be off by
+static const int SHOT_DEADBAND = 5;             // counts the arm may be off the plan
+static const double SHOT_FILTER_TIME = 0.3;     // seconds
+
+typedef enum {SHOT_NONE, SHOT_MADE, SHOT_SHORT, SHOT_LONG} shotOutcome;
+
+/**
+ * Starting calibration, distances measured with the count that scores from
+ * there.  Only the autonomous spot at the back of the key is known, so
+ * until graded shots say otherwise every distance plans the autonomous
+ * preset.  Add points here as they are measured.
+ */
+static const double SHOT_SEEDS[][2] = {
+	{14.5, 190},
+};
+
+/**
+ * Encoder counts against distance at SHOT_TABLE_STEP spacing, interpolated
+ * in between and held flat past either end.  It learns from every shot the
+ * driver grades, and the grades are kept in a log so the next match starts
+ * from everything learned so far.
+ */
+class ShotTable
+{
+	double counts[SHOT_TABLE_SIZE];
+
+	// the knot at or below distance and how far it is on to the next one
+	static void Locate(double distance, int &i, double &w)
+	{
+		double x = (distance - SHOT_TABLE_MIN) / SHOT_TABLE_STEP;
+		if(x <= 0)
+		{
+			i = 0;
+			w = 0;
+		}
+		else if(x >= SHOT_TABLE_SIZE - 1)
+		{
+			i = SHOT_TABLE_SIZE - 2;
+			w = 1;
+		}
+		else
+		{
+			i = (int)x;
+			w = x - i;
+		}
+	}
+
+	static char OutcomeChar(shotOutcome outcome)
+	{
+		return outcome == SHOT_MADE ? 'M' : outcome == SHOT_SHORT ? 'S' : outcome == SHOT_LONG ? 'L' : '-';
+	}
+
+public:
+	ShotTable()
+	{
+		Seed();
+	}
+
+	void Seed()
+	{
+		const int n = sizeof(SHOT_SEEDS) / sizeof(SHOT_SEEDS[0]);
+		for(int i = 0; i < SHOT_TABLE_SIZE; i++)
+		{
+			double d = SHOT_TABLE_MIN + i * SHOT_TABLE_STEP;
+			int j;
+			for(j = 1; j < n - 1 && d > SHOT_SEEDS[j][0]; j++);
+			if(d <= SHOT_SEEDS[0][0])
+				counts[i] = SHOT_SEEDS[0][1];
+			else if(d >= SHOT_SEEDS[n - 1][0])
+				counts[i] = SHOT_SEEDS[n - 1][1];
+			else
+				counts[i] = SHOT_SEEDS[j - 1][1] + (SHOT_SEEDS[j][1] - SHOT_SEEDS[j - 1][1]) *
+					(d - SHOT_SEEDS[j - 1][0]) / (SHOT_SEEDS[j][0] - SHOT_SEEDS[j - 1][0]);
+		}
+	}
+
+	double Value(double distance) const
+	{
+		int i;
+		double w;
+		Locate(distance, i, w);
+		return counts[i] + (counts[i + 1] - counts[i]) * w;
+	}
+
+	int Lookup(double distance) const
+	{
+		return (int)(Value(distance) + 0.5);
+	}
+
+	/**
+	 * Move the table towards what the shot should have been, sharing the
+	 * step between the two knots around it by how close each one is.
+	 */
+	void Learn(double distance, int tension, shotOutcome outcome)
+	{
+		double wanted = tension;
+		double error;
+		int i;
+		double w;
+		if(outcome == SHOT_NONE)
+			return;
+		if(outcome == SHOT_SHORT)
+			wanted += SHOT_CORRECTION;
+		else if(outcome == SHOT_LONG)
+			wanted -= SHOT_CORRECTION;
+		error = SHOT_LEARN_RATE * (wanted - Value(distance));
+		Locate(distance, i, w);
+		counts[i] += error * (1 - w);
+		counts[i + 1] += error * w;
+	}
+
+	/**
+	 * Learn every shot in a log written by AppendLog.  Returns how many.
+	 */
+	int ReadLog(const char *path)
+	{
+		FILE *f = fopen(path, "r");
+		double distance;
+		int tension, shots = 0;
+		char c;
+		if(!f)
+			return 0;
+		while(fscanf(f, "%lf %d %c", &distance, &tension, &c) == 3)
+		{
+			Learn(distance, tension, c == 'M' ? SHOT_MADE : c == 'S' ? SHOT_SHORT : c == 'L' ? SHOT_LONG : SHOT_NONE);
+			shots++;
+		}
+		fclose(f);
+		return shots;
+	}
+
+	static bool AppendLog(const char *path, double distance, int tension, shotOutcome outcome)
+	{
+		FILE *f = fopen(path, "a");
+		bool ok;
+		if(!f)
+			return false;
+		ok = fprintf(f, "%.3f %d %c\n", distance, tension, OutcomeChar(outcome)) > 0;
+		fclose(f);
+		return ok;
+	}
+
+	/**
+	 * The knots themselves, one count per line, so a replay can start from
+	 * exactly the table the robot had.
+	 */
+	bool Save(const char *path) const
+	{
+		FILE *f = fopen(path, "w");
+		if(!f)
+			return false;
+		for(int i = 0; i < SHOT_TABLE_SIZE; i++)
+			fprintf(f, "%.3f %.6f\n", SHOT_TABLE_MIN + i * SHOT_TABLE_STEP, counts[i]);
+		fclose(f);
+		return true;
+	}
+
+	bool Load(const char *path)
+	{
+		FILE *f = fopen(path, "r");
+		double distance, c[SHOT_TABLE_SIZE];
+		int i;
+		if(!f)
+			return false;
+		for(i = 0; i < SHOT_TABLE_SIZE && fscanf(f, "%lf %lf", &distance, &c[i]) == 2; i++);
+		fclose(f);
+		if(i < SHOT_TABLE_SIZE)
+			return false;
+		for(i = 0; i < SHOT_TABLE_SIZE; i++)
+			counts[i] = c[i];
+		return true;
+	}
+};
+
+/**
+ * Smooths the target distance, plans the tension for it and remembers the
+ * last shot taken at a known distance until the driver grades it.
+ */
+class ShotPlanner
+{
+	ShotTable table;
+	double distance;     // filtered, feet
+	double lastT;
+	bool tracking;
+	double shotDistance;
+	int shotTension;
+	bool shotPending;
+
+public:
+	ShotPlanner(): distance(0), lastT(0), tracking(false), shotDistance(0), shotTension(0), shotPending(false) {}
+
+	ShotTable &Table() { return table; }
+
+	/**
+	 * Forget the filter and any ungraded shot, but keep what was learned.
+	 */
+	void Reset()
+	{
+		tracking = false;
+		shotPending = false;
+	}
+
+	void Update(double t, bool locked, double d)
+	{
+		if(!locked || d <= 0)
+		{
+			tracking = false;
+		}
+		else if(!tracking)
+		{
+			distance = d;
+			tracking = true;
+		}
+		else if(t > lastT)
+		{
+			distance += (d - distance) * (t - lastT) / (SHOT_FILTER_TIME + t - lastT);
+		}
+		lastT = t;
+	}
+
+	bool HasTarget() const { return tracking; }
+	double Distance() const { return distance; }
+	int Plan() const { return table.Lookup(distance); }
+
+	void Fired(int tension)
+	{
+		shotPending = tracking;
+		shotDistance = distance;
+		shotTension = tension;
+	}
+
+	/**
+	 * Grade the last shot once.  Returns false if there was none to grade.
+	 */
+	bool Judge(shotOutcome outcome)
+	{
+		if(!shotPending || outcome == SHOT_NONE)
+			return false;
+		table.Learn(shotDistance, shotTension, outcome);
+		shotPending = false;
+		return true;
+	}
+
+	double ShotDistance() const { return shotDistance; }
+	int ShotTension() const { return shotTension; }
+};
+
+#endif
@@ -4,11 +4,25 @@
 
 #include "WPILib.h"
 #include "Vision/RGBImage.h"
-#include "Vision/BinaryImage.h"
 #include "NiVision.h"
 #include "math.h"
+#include <sockLib.h>
+#include <inetLib.h>
+#include <ioLib.h>
+#include <selectLib.h>
 
-static AxisCamera *camera;
+// shared with the host tools, so none of these may include WPILib
+#include "TeleopLogic.h"
+#include "VisionPacket.h"
+#include "VisionSource.h"
+#include "VisionScheduler.h"
+#include "RunMask.h"
+#include "LogBuffer.h"
+#include "JpegDecoder.h"
+
+// the second camera, streamed by hand since WPILib allows one AxisCamera
+static const bool SIDE_CAMERA = false;
+static const char *SIDE_CAMERA_HOST = "10.3.84.11";
 
 // lights
 static Relay *g_lights;
@@ -16,25 +30,1682 @@ static DigitalInput *g_top;
 static DigitalInput *g_middle;
 static DigitalInput *g_shooter;
 
-// encoder
-static SEM_ID armSem;
-static int encPos;
-static bool armSet;
-static double armSpeed;
+// tele-op trace, recorded when DS digital input 8 is on
+static const char *TRACE_FILE = "/teleop.trace";
+static const char *TRACE_SHOT_TABLE = "/teleop.shots";
+static const char *SHOT_LOG = "/shots.log";
+
+// auto aim
+static SEM_ID autoAimSem;
+static bool g_autoAimSet;
+static double g_targetDistance;       // feet, 0 with no confirmed lock
+static double g_targetBearing;        // radians right of the shooter, 0 with no confirmed lock
+typedef enum {TARGET_LEFT, TARGET_RIGHT, TARGET_CENTER, TARGET_NONE} targetAlignment;
+static targetAlignment g_targetAlign;
+static RobotDrive *g_sparky;
+
+// console log; lines go through the logging Task so that printing never
+// holds up the loop doing it.  LOG_SITES is in the order of logSite, with
+// the least seconds between two lines from the same site and task
+typedef enum {
+	LOG_SPARKY_START,
+	LOG_SPARKY_DONE,
+	LOG_AUTONOMOUS_START,
+	LOG_AUTONOMOUS_LEARNED,
+	LOG_AUTONOMOUS_WAITING,
+	LOG_AUTONOMOUS_WAITED,
+	LOG_AUTONOMOUS_STOP,
+	LOG_PLAN_NO_TARGET,
+	LOG_PLAN_SHOT,
+	LOG_TELEOP_START,
+	LOG_TELEOP_NO_TRACE,
+	LOG_TELEOP_LEARNED,
+	LOG_TELEOP_NO_TABLE,
+	LOG_TELEOP_TRACE_LOST,
+	LOG_TELEOP_STOP,
+	LOG_RELEASE_START,
+	LOG_RELEASE_DONE,
+	LOG_AUTO_AIM_START,
+	LOG_AUTO_AIM_DONE,
+	LOG_BLINKY_START,
+	LOG_BLINKY_DONE,
+	LOG_GOVERNOR,
+	LOG_QUEUE_DROPPED,
+	LOG_WORK_STATS,
+	LOG_STREAM_NO_SOCKET,
+	LOG_MJPEG_NO_CONNECT,
+	LOG_MJPEG_LOST,
+	LOG_MJPEG_TOO_BIG,
+	LOG_NO_PIPELINE,
+	LOG_CAPTURE_START,
+	LOG_COPY_FAILED,
+	LOG_CAPTURE_STOP,
+	LOG_WORKER_START,
+	LOG_NO_SIZE,
+	LOG_DECODE_COMPARE,
+	LOG_IMAGE_ERROR,
+	LOG_NO_PARTICLES,
+	LOG_PARTICLES,
+	LOG_WORKER_STOP,
+	LOG_TARGETING_START,
+	LOG_NOT_FRESH,
+	LOG_TARGETING_STOP,
+	LOG_SITE_COUNT
+} logSite;
+static const LogSite LOG_SITES[LOG_SITE_COUNT] = {
+	{"Sparky: start", 0},
+	{"Sparky: done", 0},
+	{"Autonomous: start", 0},
+	{"Autonomous: learned from %d shots", 0},
+	{"Waiting %d...", 0},
+	{"Waiting done!", 0},
+	{"Autonomous: stop", 0},
+	{"PlanShot: no target, using %d", 0},
+	{"PlanShot: %f ft -> %d", 0},
+	{"OperatorControl: start", 0},
+	{"OperatorControl: can't open %s", 0},
+	{"OperatorControl: learned from %d shots", 0},
+	{"OperatorControl: can't save %s", 0},
+	{"OperatorControl: %u trace records lost", 0},
+	{"OperatorControl: stop", 0},
+	{"Release: start", 0},
+	{"Release: done", 0},
+	{"AutoAim: start", 0},
+	{"AutoAim: done", 0},
+	{"BlinkyLights: start", 0},
+	{"BlinkyLights: done", 0},
+	{"CameraGovernor: %.1f fps processed, %.0f%% dropped, %.3f s/frame -> fps %d, compression %d, decode 1/%d", 0},
+	{"VisionQueue %s: %d frames dropped", 0},
+	{"VisionWork: camera %d %ld frames, %ld dropped, %.3f s busy/frame, latency %.3f avg %.3f worst, %ld over %.3f", 0},
+	{"VisionStream: can't open socket", 0},
+	{"MjpegVisionSource: can't connect to %s", 5},
+	{"MjpegVisionSource: lost %s", 0},
+	{"MjpegVisionSource: %s sent a %d byte frame", 1},
+	{"VisionDetector: no specialized pipeline for %dx%d", 0},
+	{"VisionCapture: start", 0},
+	{"Image copy failed (%s).", 1},
+	{"VisionCapture: stop", 0},
+	{"VisionWorker: start", 0},
+	{"Image width or height is 0 (%s).", 1},
+	{"VisionWorker: %s decode at 1/%d %.4f s, full size %.4f s", 0},
+	{"Image processing error.", 1},
+	{"No particles found.", 1},
+	{"Particles found.", 1},
+	{"VisionWorker: stop", 0},
+	{"Targeting: start", 0},
+	{"Image is not fresh.", 1},
+	{"Targeting: stop", 0},
+};
+static LogBuffer *g_log;
+static SEM_ID g_logSem;        // taken only to hand a Task its ring
+
+/**
+ * Queue a line for the logging Task, with arguments as for the site's
+ * format.  No formatting or console I/O happens here.
+ */
+static void Log(int site, ...)
+{
+	int task = taskIdSelf();
+	LogRing *ring;
+	va_list ap;
+	if(!g_log)
+		return;
+	if(!(ring = g_log->Find(task)))
+	{
+		Synchronized sync(g_logSem);
+		if(!(ring = g_log->Claim(task, taskName(task))))
+			return;
+	}
+	va_start(ap, site);
+	g_log->Write(ring, site, GetTime(), ap);
+	va_end(ap);
+}
+
+/**
+ * Tele-op trace records on their way to flash.  The control loop packs
+ * each record into memory and the logging Task writes them out, so the
+ * loop never waits on the file.
+ */
+class TraceBuffer
+{
+	static const int RECORDS = 1024;   // 5 s of 5 ms loops
+	unsigned char records[RECORDS][TraceRecord::SIZE];
+	volatile unsigned head;            // written by the control loop
+	volatile unsigned tail;            // written by the logging Task
+	unsigned lost;
+	FILE *file;
+	SEM_ID sem;                        // held while the file is written or closed
+
+	void WriteOut()
+	{
+		while(tail != head)
+		{
+			LOG_BARRIER();
+			fwrite(records[tail % RECORDS], TraceRecord::SIZE, 1, file);
+			LOG_BARRIER();
+			tail++;
+		}
+	}
+
+public:
+	TraceBuffer():
+		head(0),
+		tail(0),
+		lost(0),
+		file(NULL),
+		sem(semMCreate(SEM_Q_PRIORITY | SEM_DELETE_SAFE | SEM_INVERSION_SAFE))
+	{
+	}
+
+	bool Open(const char *path)
+	{
+		Synchronized sync(sem);
+		head = tail = 0;
+		lost = 0;
+		file = fopen(path, "wb");
+		return file != NULL;
+	}
+
+	/**
+	 * Queue a record, or count it lost if the logging Task is too far
+	 * behind.  Control loop only.
+	 */
+	void Put(const TraceRecord &r)
+	{
+		unsigned h = head;
+		if(h - tail >= (unsigned)RECORDS)
+		{
+			lost++;
+			return;
+		}
+		r.Pack(records[h % RECORDS]);
+		LOG_BARRIER();
+		head = h + 1;
+	}
+
+	/**
+	 * Write out whatever is queued.  Logging Task only.
+	 */
+	void Flush()
+	{
+		Synchronized sync(sem);
+		if(file)
+			WriteOut();
+	}
+
+	/**
+	 * Write out the rest and close the file.  Returns the records lost.
+	 */
+	unsigned Close()
+	{
+		Synchronized sync(sem);
+		if(!file)
+			return 0;
+		WriteOut();
+		fclose(file);
+		file = NULL;
+		return lost;
+	}
+};
+static TraceBuffer *g_trace;
+
+/**
+ * Keeps the camera's frame rate, compression and decode scale in line with
+ * what the targeting loop actually processes.  Capture reports every poll
+ * and targeting every processed frame; once per window the governor
+ * compares that against what the camera was asked to send and rewrites
+ * the settings within the configured bounds.  The camera streams at one
+ * resolution and the workers decode it at 1/scale, so trading resolution
+ * for speed doesn't restart the camera's stream.  Only time spent
+ * polling counts: the window starts over when vision starts and after any
+ * gap in the reports.
+ */
+class CameraGovernor
+{
+	AxisCamera *camera;
+	int minFPS, maxFPS;
+	int minCompression, maxCompression;
+	int minScale, maxScale;
+	int fps, compression;
+	volatile int scale;
+	double frameBudget;
+	SEM_ID sem;
+	Timer window;
+	int frames;
+	int missed;                     // frame deadlines at the commanded fps that passed with no frame
+	double deadline;
+	double processTime;
+	double lastReport;
+
+	// windowing and hysteresis
+	static const double WINDOW = 3.0;
+	static const double GAP = 1.0;             // seconds without a report that start a new window
+	static const double DEADLINE_SLACK = 1.5;  // frame periods before a frame counts as missed
+	static const int WINDOW_MIN_FRAMES = 5;
+	static const double DROP_HIGH = 0.25;
+	static const double DROP_LOW = 0.05;
+	static const int COMPRESSION_STEP = 10;
+
+	void ResetWindow(double now)
+	{
+		frames = 0;
+		missed = 0;
+		processTime = 0;
+		lastReport = now;
+		deadline = now + DEADLINE_SLACK / fps;
+		window.Reset();
+	}
+
+	// a gap means nobody was polling, so the window so far measures nothing
+	void Report(double now)
+	{
+		if(now - lastReport > GAP)
+			ResetWindow(now);
+		lastReport = now;
+	}
+
+public:
+	/**
+	 * Scales are 1, 2, 4 or 8, decoding the camera's resolution at full
+	 * size down to an eighth.  The frame budget is the processing time per
+	 * frame we are willing to spend before trading image quality for speed.
+	 */
+	CameraGovernor(AxisCamera *c, int minFPS, int maxFPS, int minCompression, int maxCompression,
+			AxisCameraParams::Resolution_t resolution, int minScale, int maxScale, double frameBudget):
+		camera(c),
+		minFPS(minFPS),
+		maxFPS(maxFPS),
+		minCompression(minCompression),
+		maxCompression(maxCompression),
+		minScale(minScale),
+		maxScale(maxScale),
+		fps(maxFPS),
+		compression(minCompression),
+		scale(minScale),
+		frameBudget(frameBudget),
+		sem(semMCreate(SEM_Q_PRIORITY | SEM_DELETE_SAFE | SEM_INVERSION_SAFE)),
+		frames(0),
+		missed(0),
+		deadline(0),
+		processTime(0),
+		lastReport(0)
+	{
+		camera->WriteResolution(resolution);
+		camera->WriteCompression(compression);
+		camera->WriteMaxFPS(fps);
+		window.Start();
+		ResetWindow(GetTime());
+	}
+
+	~CameraGovernor()
+	{
+		semDelete(sem);
+	}
+
+	/**
+	 * What the workers divide the camera's resolution by when decoding.
+	 */
+	int DecodeScale() const
+	{
+		return scale;
+	}
+
+	/**
+	 * Start a new window, forgetting what was counted so far.  Called when
+	 * vision starts or resumes, so time spent disabled doesn't read as
+	 * frames the loop failed to process.
+	 */
+	void Restart()
+	{
+		Synchronized sync(sem);
+		ResetWindow(GetTime());
+	}
+
+	/**
+	 * Called on every look for a new frame.  Polling finds nothing most of
+	 * the time; only a frame due at the commanded rate that hasn't come
+	 * counts as the loop waiting on the camera.
+	 */
+	void Polled(bool fresh)
+	{
+		Synchronized sync(sem);
+		double now = GetTime();
+		Report(now);
+		if(fresh)
+		{
+			deadline = now + DEADLINE_SLACK / fps;
+		}
+		else if(now > deadline)
+		{
+			missed++;
+			deadline = now + 1.0 / fps;
+		}
+	}
+
+	/**
+	 * Called once per processed frame with the time spent on it.
+	 */
+	void FrameProcessed(double t)
+	{
+		Synchronized sync(sem);
+		double now = GetTime();
+		Report(now);
+		frames++;
+		processTime += t;
+		if(window.Get() < WINDOW || frames < WINDOW_MIN_FRAMES)
+			return;
+
+		double elapsed = window.Get();
+		double processedFPS = frames / elapsed;
+		double avgProcess = processTime / frames;
+		double drop = 1.0 - processedFPS / fps;
+		int newFPS = fps;
+		int newCompression = compression;
+		int newScale = scale;
+
+		// frame rate follows what we consume
+		if(drop > DROP_HIGH)
+		{
+			newFPS = (int)ceil(processedFPS);
+		}
+		else if(drop < DROP_LOW && missed > 0)
+		{
+			newFPS = fps + 1;
+		}
+		if(newFPS < minFPS)
+			newFPS = minFPS;
+		if(newFPS > maxFPS)
+			newFPS = maxFPS;
+
+		// decode cost follows compression, then scale
+		if(avgProcess > frameBudget)
+		{
+			if(compression < maxCompression)
+				newCompression = compression + COMPRESSION_STEP;
+			else if(scale < maxScale)
+				newScale = scale * 2;
+		}
+		else if(avgProcess < frameBudget / 2)
+		{
+			if(compression > minCompression)
+				newCompression = compression - COMPRESSION_STEP;
+			else if(scale > minScale)
+				newScale = scale / 2;
+		}
+		if(newCompression > maxCompression)
+			newCompression = maxCompression;
+		if(newCompression < minCompression)
+			newCompression = minCompression;
+
+		// every camera write restarts its stream, so only write changes;
+		// the scale is ours and costs nothing to change
+		if(newFPS != fps)
+		{
+			fps = newFPS;
+			camera->WriteMaxFPS(fps);
+		}
+		if(newCompression != compression)
+		{
+			compression = newCompression;
+			camera->WriteCompression(compression);
+		}
+		scale = newScale;
+		Log(LOG_GOVERNOR,
+				processedFPS, drop > 0 ? drop * 100 : 0, avgProcess, fps, compression, scale);
+		ResetWindow(now);
+	}
+};
+
+
+// target tracking
+typedef enum {TRACK_LOWEST, TRACK_CENTERMOST, TRACK_ID} trackPolicy;
+
+/**
+ * One rectangle found in a frame.
+ */
+struct TargetDetection
+{
+	double x, y;           // center of mass, pixels
+	double width, height;  // bounding rect, pixels
+	int left, top;
+	double distance;       // from the pose when there is one
+	int imageWidth;
+	bool posed;            // bearing is from the corners and viewAngle is valid
+	double bearing;        // radians right of the camera axis
+	double viewAngle;      // radians off the backboard's normal
+};
+
+/**
+ * A rectangle followed across frames.  Age counts the frames it has been
+ * matched; missed counts consecutive frames it has not.
+ */
+struct TargetTrack
+{
+	int id;
+	double x, y;
+	double width, height;
+	double vx, vy;         // pixels per second
+	double distance;
+	int imageWidth;
+	bool posed;
+	double bearing;
+	double viewAngle;
+	int age;
+	int missed;
+	double lastSeen;
+};
+
+/**
+ * Associates every detected rectangle with the tracks of the previous
+ * frame by nearest neighbor on predicted center and size, so each basket
+ * keeps its ID while it stays in view.  Updated by the targeting task and
+ * read by the control code.
+ */
+class TargetTracker
+{
+	vector<TargetTrack> tracks;
+	int nextId;
+	SEM_ID sem;
+
+	static const double MATCH_GATE = 60;   // max match cost, pixels
+	static const double VELOCITY_GAIN = 0.5;
+	static const int MAX_MISSED = 5;
+
+	static double Cost(const TargetTrack &t, const TargetDetection &d, double now)
+	{
+		double dt = now - t.lastSeen;
+		double dx = t.x + t.vx * dt - d.x;
+		double dy = t.y + t.vy * dt - d.y;
+		return sqrt(dx * dx + dy * dy) + fabs(t.width - d.width) + fabs(t.height - d.height);
+	}
+
+public:
+	TargetTracker():
+		nextId(1),
+		sem(semMCreate(SEM_Q_PRIORITY | SEM_DELETE_SAFE | SEM_INVERSION_SAFE))
+	{
+	}
+
+	~TargetTracker()
+	{
+		semDelete(sem);
+	}
+
+	/**
+	 * Match this frame's detections to the existing tracks, start tracks
+	 * for the leftovers and retire tracks that have been missing too long.
+	 */
+	void Update(const vector<TargetDetection> &detections, double now)
+	{
+		Synchronized sync(sem);
+		vector<bool> trackUsed(tracks.size(), false);
+		vector<bool> detectionUsed(detections.size(), false);
+		unsigned i, j;
+
+		// greedy global nearest neighbor, cheapest pair first
+		while(true)
+		{
+			double best = MATCH_GATE;
+			int bi = -1, bj = -1;
+			for(i = 0; i < tracks.size(); i++)
+			{
+				if(trackUsed[i])
+					continue;
+				for(j = 0; j < detections.size(); j++)
+				{
+					if(detectionUsed[j])
+						continue;
+					double c = Cost(tracks[i], detections[j], now);
+					if(c < best)
+					{
+						best = c;
+						bi = i;
+						bj = j;
+					}
+				}
+			}
+			if(bi < 0)
+				break;
+
+			TargetTrack &t = tracks[bi];
+			const TargetDetection &d = detections[bj];
+			double dt = now - t.lastSeen;
+			if(dt > 0)
+			{
+				t.vx = (1 - VELOCITY_GAIN) * t.vx + VELOCITY_GAIN * (d.x - t.x) / dt;
+				t.vy = (1 - VELOCITY_GAIN) * t.vy + VELOCITY_GAIN * (d.y - t.y) / dt;
+			}
+			t.x = d.x;
+			t.y = d.y;
+			t.width = d.width;
+			t.height = d.height;
+			t.distance = d.distance;
+			t.imageWidth = d.imageWidth;
+			t.posed = d.posed;
+			t.bearing = d.bearing;
+			t.viewAngle = d.viewAngle;
+			t.age++;
+			t.missed = 0;
+			t.lastSeen = now;
+			trackUsed[bi] = true;
+			detectionUsed[bj] = true;
+		}
+
+		for(i = 0; i < tracks.size(); i++)
+		{
+			if(!trackUsed[i])
+				tracks[i].missed++;
+		}
+		for(i = 0; i < tracks.size(); )
+		{
+			if(tracks[i].missed > MAX_MISSED)
+				tracks.erase(tracks.begin() + i);
+			else
+				i++;
+		}
+
+		for(j = 0; j < detections.size(); j++)
+		{
+			if(detectionUsed[j])
+				continue;
+			TargetTrack t;
+			t.id = nextId++;
+			t.x = detections[j].x;
+			t.y = detections[j].y;
+			t.width = detections[j].width;
+			t.height = detections[j].height;
+			t.vx = t.vy = 0;
+			t.distance = detections[j].distance;
+			t.imageWidth = detections[j].imageWidth;
+			t.posed = detections[j].posed;
+			t.bearing = detections[j].bearing;
+			t.viewAngle = detections[j].viewAngle;
+			t.age = 1;
+			t.missed = 0;
+			t.lastSeen = now;
+			tracks.push_back(t);
+		}
+	}
+
+	/**
+	 * Pick a track by policy.  Lowest and centermost only consider tracks
+	 * seen in the latest frame; a specific ID is followed while it coasts.
+	 * Returns false if nothing qualifies.
+	 */
+	bool Select(trackPolicy policy, int id, TargetTrack &target)
+	{
+		Synchronized sync(sem);
+		int best = -1;
+		for(unsigned i = 0; i < tracks.size(); i++)
+		{
+			const TargetTrack &t = tracks[i];
+			if(policy == TRACK_ID)
+			{
+				if(t.id == id)
+					best = i;
+				continue;
+			}
+			if(t.missed)
+				continue;
+			if(best < 0)
+			{
+				best = i;
+			}
+			else if(policy == TRACK_LOWEST)
+			{
+				// image y grows downward
+				if(t.y > tracks[best].y)
+					best = i;
+			}
+			else if(fabs(t.x - t.imageWidth / 2) < fabs(tracks[best].x - tracks[best].imageWidth / 2))
+			{
+				best = i;
+			}
+		}
+		if(best < 0)
+			return false;
+		target = tracks[best];
+		return true;
+	}
+
+	/**
+	 * Snapshot of all current tracks.
+	 */
+	vector<TargetTrack> GetTracks()
+	{
+		Synchronized sync(sem);
+		return tracks;
+	}
+};
+
+static trackPolicy g_trackPolicy;
+static int g_trackId;
+static int g_trackCamera;      // camera g_trackId belongs to
+static int g_targetCamera;     // camera the merged target is aimed from
+
+// vision pipeline
+extern "C" int Priv_ReadJPEGString_C(Image *_image, const unsigned char *_string, UINT32 _stringLength);
+
+/**
+ * One camera frame on its way through the vision stages.  Each stage fills
+ * in its part and frees what the next stages no longer need.
+ */
+struct VisionFrame
+{
+	int camera;            // index in g_cameras
+	unsigned seq;
+	double timestamp;      // capture time
+	char *jpeg;
+	int jpegSize;
+	int jpegBufferSize;
+	ColorImage *image;
+	int imageWidth;
+	int imageHeight;
+	int threshold;         // index of the threshold that matched, -1 for none
+	vector<TargetDetection> detections;
+	double decodeTime;
+	double detectTime;
+
+	VisionFrame():
+		camera(0),
+		seq(0),
+		timestamp(0),
+		jpeg(NULL),
+		jpegSize(0),
+		jpegBufferSize(0),
+		image(NULL),
+		imageWidth(0),
+		imageHeight(0),
+		threshold(-1),
+		decodeTime(0),
+		detectTime(0)
+	{
+	}
+
+	~VisionFrame()
+	{
+		delete [] jpeg;
+		delete image;
+	}
+};
+
+/**
+ * Bounded FIFO of frames between two vision stages, built on a VxWorks
+ * message queue so the consumer blocks without polling.  When the consumer
+ * falls behind the oldest frame is dropped, so a slow stage always works
+ * on the newest image.
+ */
+class VisionQueue
+{
+	MSG_Q_ID queue;
+	const char *name;
+	int dropped;
+
+public:
+	VisionQueue(const char *name, int depth):
+		queue(msgQCreate(depth, sizeof(VisionFrame *), MSG_Q_FIFO)),
+		name(name),
+		dropped(0)
+	{
+	}
+
+	~VisionQueue()
+	{
+		VisionFrame *frame;
+		while((frame = Get(NO_WAIT)) != NULL)
+			delete frame;
+		msgQDelete(queue);
+	}
+
+	void Put(VisionFrame *frame)
+	{
+		VisionFrame *old;
+		while(msgQSend(queue, (char *)&frame, sizeof(frame), NO_WAIT, MSG_PRI_NORMAL) == ERROR)
+		{
+			if(msgQReceive(queue, (char *)&old, sizeof(old), NO_WAIT) != ERROR)
+			{
+				delete old;
+				if(++dropped % 100 == 0)
+					Log(LOG_QUEUE_DROPPED, name, dropped);
+			}
+		}
+	}
+
+	/**
+	 * Wait up to timeout ticks for a frame.  Returns NULL on timeout.
+	 */
+	VisionFrame *Get(int timeout)
+	{
+		VisionFrame *frame;
+		if(msgQReceive(queue, (char *)&frame, sizeof(frame), timeout) == ERROR)
+			return NULL;
+		return frame;
+	}
+};
+
+static VisionQueue *g_resultQueue;
+
+/**
+ * Frames waiting for the shared pool of vision workers, newest per camera.
+ * A FrameScheduler behind a mutex picks what runs next; the workers sleep
+ * on a counting semaphore given once per frame offered.
+ */
+class VisionWork
+{
+	FrameScheduler<VisionFrame> scheduler;
+	SEM_ID sem;
+	SEM_ID ready;
+
+	static const int REPORT_EVERY = 100;   // frames per camera between reports
+
+public:
+	VisionWork():
+		sem(semMCreate(SEM_Q_PRIORITY | SEM_DELETE_SAFE | SEM_INVERSION_SAFE)),
+		ready(semCCreate(SEM_Q_PRIORITY, 0))
+	{
+	}
+
+	~VisionWork()
+	{
+		VisionFrame *frame;
+		int camera;
+		while((frame = scheduler.Next(camera)) != NULL)
+			delete frame;
+		semDelete(ready);
+		semDelete(sem);
+	}
+
+	/**
+	 * Share is the camera's weight in the pool, latencyTarget the seconds
+	 * from capture to detections it should see.
+	 */
+	int AddCamera(double share, double latencyTarget)
+	{
+		Synchronized sync(sem);
+		return scheduler.AddCamera(share, latencyTarget);
+	}
+
+	void Put(VisionFrame *frame)
+	{
+		VisionFrame *old;
+		{
+			Synchronized sync(sem);
+			old = scheduler.Offer(frame->camera, frame, frame->timestamp);
+		}
+		delete old;
+		semGive(ready);
+	}
+
+	/**
+	 * Wait up to timeout ticks for a frame.  Returns NULL on timeout.
+	 */
+	VisionFrame *Get(int timeout)
+	{
+		VisionFrame *frame;
+		int camera;
+		while(true)
+		{
+			{
+				Synchronized sync(sem);
+				frame = scheduler.Next(camera);
+			}
+			if(frame)
+				return frame;
+			if(semTake(ready, timeout) == ERROR)
+				return NULL;
+		}
+	}
+
+	/**
+	 * A worker is through with frame after busy seconds.
+	 */
+	void Done(VisionFrame *frame, double busy, double latency)
+	{
+		Synchronized sync(sem);
+		scheduler.Done(frame->camera, busy, latency);
+		const CameraStats &st = scheduler.Stats(frame->camera);
+		if(st.served >= REPORT_EVERY)
+		{
+			Log(LOG_WORK_STATS,
+					frame->camera, st.served, st.dropped, st.busy / st.served, st.latencySum / st.served,
+					st.worstLatency, st.late, scheduler.LatencyTarget(frame->camera));
+			scheduler.ClearStats(frame->camera);
+		}
+	}
+};
+
+static VisionWork *g_visionWork;
+
+// dashboard vision stream
+static const char *VISION_STREAM_HOST = "10.3.84.5";
+
+/**
+ * Sends each frame's VisionResult to the dashboard over UDP, plus an
+ * occasional grayscale thumbnail with the detections drawn in.  See
+ * VisionPacket.h for the wire format.
+ */
+class VisionStream
+{
+	int sock;
+	struct sockaddr_in addr;
+	double framePeriod;
+	double lastFrame;
+	SEM_ID frameSem;                // one thumbnail at a time, so chunks don't interleave
+
+	static const int THUMB_WIDTH = 80;
+	static const int THUMB_HEIGHT = 60;
+
+	void Send(const unsigned char *buf, int len)
+	{
+		if(sock != ERROR)
+			sendto(sock, (char *)buf, len, 0, (struct sockaddr *)&addr, sizeof(addr));
+	}
+
+	static void DrawRect(unsigned char *thumb, int l, int t, int r, int b)
+	{
+		int x, y;
+		if(l < 0) l = 0;
+		if(t < 0) t = 0;
+		if(r >= THUMB_WIDTH) r = THUMB_WIDTH - 1;
+		if(b >= THUMB_HEIGHT) b = THUMB_HEIGHT - 1;
+		for(x = l; x <= r; x++)
+			thumb[t * THUMB_WIDTH + x] = thumb[b * THUMB_WIDTH + x] = 255;
+		for(y = t; y <= b; y++)
+			thumb[y * THUMB_WIDTH + l] = thumb[y * THUMB_WIDTH + r] = 255;
+	}
+
+public:
+	/**
+	 * Thumbnails go out at most once every framePeriod seconds.
+	 */
+	VisionStream(const char *host, int port, double framePeriod):
+		sock(socket(AF_INET, SOCK_DGRAM, 0)),
+		framePeriod(framePeriod),
+		lastFrame(0),
+		frameSem(semMCreate(SEM_Q_PRIORITY | SEM_DELETE_SAFE | SEM_INVERSION_SAFE))
+	{
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_len = (u_char)sizeof(addr);
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = inet_addr((char *)host);
+		if(sock == ERROR)
+			Log(LOG_STREAM_NO_SOCKET);
+	}
+
+	~VisionStream()
+	{
+		if(sock != ERROR)
+			close(sock);
+		semDelete(frameSem);
+	}
+
+	void SendResult(const VisionResult &r)
+	{
+		unsigned char buf[VisionResult::SIZE];
+		Send(buf, r.Pack(buf));
+	}
+
+	/**
+	 * Downscale by sampling, convert to luma, outline the detections and
+	 * send the result in chunks, unless a thumbnail went out less than
+	 * framePeriod ago.  Safe from any worker.
+	 */
+	void SendFrame(int camera, unsigned long seq, ColorImage *image, const vector<TargetDetection> &detections,
+			double now)
+	{
+		unsigned char thumb[THUMB_WIDTH * THUMB_HEIGHT];
+		unsigned char buf[VisionFrameChunk::HEADER_SIZE + VISION_CHUNK_PAYLOAD];
+		ImageInfo info;
+		VisionFrameChunk h;
+		int x, y, len;
+		unsigned i;
+
+		Synchronized sync(frameSem);
+		if(now - lastFrame < framePeriod)
+			return;
+		lastFrame = now;
+		if(!imaqGetImageInfo(image->GetImaqImage(), &info) || !info.xRes || !info.yRes)
+			return;
+		const RGBValue *pixels = (const RGBValue *)info.imageStart;
+		for(y = 0; y < THUMB_HEIGHT; y++)
+		{
+			const RGBValue *row = pixels + (y * info.yRes / THUMB_HEIGHT) * info.pixelsPerLine;
+			for(x = 0; x < THUMB_WIDTH; x++)
+			{
+				const RGBValue &p = row[x * info.xRes / THUMB_WIDTH];
+				thumb[y * THUMB_WIDTH + x] = (unsigned char)((p.R * 77 + p.G * 150 + p.B * 29) >> 8);
+			}
+		}
+		for(i = 0; i < detections.size(); i++)
+		{
+			const TargetDetection &d = detections[i];
+			DrawRect(thumb,
+					d.left * THUMB_WIDTH / info.xRes,
+					d.top * THUMB_HEIGHT / info.yRes,
+					(int)(d.left + d.width) * THUMB_WIDTH / info.xRes,
+					(int)(d.top + d.height) * THUMB_HEIGHT / info.yRes);
+		}
+
+		h.camera = camera;
+		h.seq = seq;
+		h.width = THUMB_WIDTH;
+		h.height = THUMB_HEIGHT;
+		h.chunks = (sizeof(thumb) + VISION_CHUNK_PAYLOAD - 1) / VISION_CHUNK_PAYLOAD;
+		for(h.chunk = 0; h.chunk < h.chunks; h.chunk++)
+		{
+			len = sizeof(thumb) - h.chunk * VISION_CHUNK_PAYLOAD;
+			if(len > VISION_CHUNK_PAYLOAD)
+				len = VISION_CHUNK_PAYLOAD;
+			h.PackHeader(buf);
+			memcpy(buf + VisionFrameChunk::HEADER_SIZE, thumb + h.chunk * VISION_CHUNK_PAYLOAD, len);
+			Send(buf, VisionFrameChunk::HEADER_SIZE + len);
+		}
+	}
+};
+
+static VisionStream *g_visionStream;
+
+/**
+ * The AxisCamera as a VisionSource.
+ */
+class AxisVisionSource : public VisionSource
+{
+	AxisCamera *camera;
+
+public:
+	AxisVisionSource(AxisCamera *c): camera(c) {}
+
+	bool IsFreshImage()
+	{
+		return camera->IsFreshImage();
+	}
+
+	int CopyJPEG(char **buf, int &size, int &bufferSize)
+	{
+		return camera->CopyJPEG(buf, size, bufferSize);
+	}
+};
+
+/**
+ * An Axis camera read straight off its MJPEG stream.  AxisCamera is a
+ * singleton, so every camera after the first comes in this way.  A task
+ * reads the stream and keeps the newest JPEG; it reconnects whenever the
+ * stream drops or goes quiet.
+ */
+class MjpegVisionSource : public VisionSource
+{
+	const char *host;
+	char request[256];
+	char taskName[32];              // one per camera; log rings go by task name
+	Task task;
+	SEM_ID sem;
+	vector<char> latest;
+	bool fresh;
+	int sock;
+	char buf[1024];
+	int bufStart, bufEnd;
+
+	static const int RECV_TIMEOUT = 2;          // seconds of silence before reconnecting
+	static const int MAX_JPEG = 256 * 1024;     // bytes; anything bigger is a broken stream
+
+	static int Run(MjpegVisionSource *source)
+	{
+		source->Stream();
+		return 0;
+	}
+
+	static const char *TaskName(char *name, const char *host)
+	{
+		sprintf(name, "mjpeg%.20s", host);
+		return name;
+	}
+
+	// refill the read buffer, false when the connection is gone or silent
+	bool Fill()
+	{
+		fd_set readable;
+		struct timeval timeout;
+		FD_ZERO(&readable);
+		FD_SET(sock, &readable);
+		timeout.tv_sec = RECV_TIMEOUT;
+		timeout.tv_usec = 0;
+		if(select(sock + 1, &readable, NULL, NULL, &timeout) <= 0)
+			return false;
+		int n = recv(sock, buf, sizeof(buf), 0);
+		if(n <= 0)
+			return false;
+		bufStart = 0;
+		bufEnd = n;
+		return true;
+	}
+
+	bool ReadLine(char *line, int size)
+	{
+		int n = 0;
+		while(true)
+		{
+			if(bufStart == bufEnd && !Fill())
+				return false;
+			char c = buf[bufStart++];
+			if(c == '\n')
+				break;
+			if(c != '\r' && n < size - 1)
+				line[n++] = c;
+		}
+		line[n] = 0;
+		return true;
+	}
+
+	bool Read(char *dst, int len)
+	{
+		while(len > 0)
+		{
+			if(bufStart == bufEnd && !Fill())
+				return false;
+			int n = bufEnd - bufStart < len ? bufEnd - bufStart : len;
+			memcpy(dst, buf + bufStart, n);
+			bufStart += n;
+			dst += n;
+			len -= n;
+		}
+		return true;
+	}
+
+	void Stream()
+	{
+		struct sockaddr_in addr;
+		vector<char> jpeg;
+		char line[128];
+		while(true)
+		{
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_len = (u_char)sizeof(addr);
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(80);
+			addr.sin_addr.s_addr = inet_addr((char *)host);
+			sock = socket(AF_INET, SOCK_STREAM, 0);
+			bufStart = bufEnd = 0;
+			if(sock == ERROR || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == ERROR ||
+					send(sock, request, strlen(request), 0) != (int)strlen(request))
+			{
+				Log(LOG_MJPEG_NO_CONNECT, host);
+				if(sock != ERROR)
+					close(sock);
+				Wait(1.0);
+				continue;
+			}
+
+			// each part is a few headers, a blank line and Content-Length bytes of JPEG
+			int length = 0;
+			while(ReadLine(line, sizeof(line)))
+			{
+				if(!strncmp(line, "Content-Length:", 15) || !strncmp(line, "content-length:", 15))
+				{
+					length = atoi(line + 15);
+					if(length > MAX_JPEG)
+					{
+						Log(LOG_MJPEG_TOO_BIG, host, length);
+						break;
+					}
+				}
+				else if(!line[0] && length > 0)
+				{
+					jpeg.resize(length);
+					if(!Read(&jpeg[0], length))
+						break;
+					Synchronized sync(sem);
+					latest.swap(jpeg);
+					fresh = true;
+					length = 0;
+				}
+			}
+			Log(LOG_MJPEG_LOST, host);
+			close(sock);
+			Wait(0.5);
+		}
+	}
+
+public:
+	MjpegVisionSource(const char *host, int width, int height, int fps):
+		host(host),
+		task(TaskName(taskName, host), (FUNCPTR)Run, 102),
+		sem(semMCreate(SEM_Q_PRIORITY | SEM_DELETE_SAFE | SEM_INVERSION_SAFE)),
+		fresh(false),
+		sock(ERROR),
+		bufStart(0),
+		bufEnd(0)
+	{
+		// the FRC default account, as AxisCamera logs in with
+		sprintf(request, "GET /axis-cgi/mjpg/video.cgi?resolution=%dx%d&fps=%d HTTP/1.1\r\n"
+				"Host: %s\r\nAuthorization: Basic RlJDOkZSQw==\r\n\r\n", width, height, fps, host);
+		task.Start((UINT32)this);
+	}
+
+	bool IsFreshImage()
+	{
+		Synchronized sync(sem);
+		return fresh;
+	}
+
+	int CopyJPEG(char **dst, int &size, int &bufferSize)
+	{
+		Synchronized sync(sem);
+		if(!latest.size())
+			return 0;
+		size = latest.size();
+		if(!*dst || bufferSize < size)
+		{
+			delete [] *dst;
+			bufferSize = size;
+			*dst = new char[bufferSize];
+		}
+		memcpy(*dst, &latest[0], size);
+		fresh = false;
+		return size;
+	}
+};
+
+// vision pipeline configuration
+static const Threshold LED_THRESHOLDS[] = {
+	Threshold(141, 253, 103, 253, 72, 255) // LED flashlight
+	//Threshold(126, 224, 210, 255, 0, 138)  // field
+	//Threshold(0, 177, 165, 255, 0, 141)    // practice field
+	//Threshold(0, 158, 123, 255, 0, 160)    // night
+	//Threshold(107, 189, 150, 255, 68, 167) // day
+	//Threshold(78, 210, 184, 255, 0, 190)   // day close
+};
+
+/**
+ * Threshold sets, tried in order until one of them finds a target.
+ */
+struct LedThresholds
+{
+	static int Count() { return sizeof(LED_THRESHOLDS) / sizeof(LED_THRESHOLDS[0]); }
+	static const Threshold &Get(int i) { return LED_THRESHOLDS[i]; }
+};
+
+/**
+ * Axis camera and backboard tape as mounted on Sparky.
+ */
+struct SparkyGeometry
+{
+	static double DegsVert() { return 20; }
+	static double TapeHeight() { return 1.5; }
+	static double TapeWidth() { return 2.0; }
+	static int MinRect() { return 10; }
+	static int MaxRect() { return 400; }
+
+	// pinhole intrinsics in pixels at 320x240; nominal values from the 20
+	// degree half FOV until the camera has been through a calibration
+	static double FocalLengthX() { return 329.7; }
+	static double FocalLengthY() { return 329.7; }
+	static double CenterX() { return 159.5; }
+	static double CenterY() { return 119.5; }
+};
+
+/**
+ * Pinhole camera intrinsics for one resolution, in pixels.
+ */
+struct CameraIntrinsics
+{
+	double fx, fy, cx, cy;
+
+	// scale the 320x240 calibration to the frame size
+	template <class G>
+	static CameraIntrinsics For(int width, int height)
+	{
+		CameraIntrinsics k;
+		k.fx = G::FocalLengthX() * width / 320;
+		k.fy = G::FocalLengthY() * height / 240;
+		k.cx = (G::CenterX() + 0.5) * width / 320 - 0.5;
+		k.cy = (G::CenterY() + 0.5) * height / 240 - 0.5;
+		return k;
+	}
+};
+
+/**
+ * A vision configuration fixed at compile time.  Everything is a constant
+ * the compiler can fold into VisionPipeline's loops.
+ */
+template <int W, int H, class T = LedThresholds, class G = SparkyGeometry>
+struct VisionConfig
+{
+	int Width() const { return W; }
+	int Height() const { return H; }
+	int Thresholds() const { return T::Count(); }
+	const Threshold &GetThreshold(int i) const { return T::Get(i); }
+	double DegsVert() const { return G::DegsVert(); }
+	double TapeHeight() const { return G::TapeHeight(); }
+	double TapeWidth() const { return G::TapeWidth(); }
+	int MinRect() const { return G::MinRect(); }
+	int MaxRect() const { return G::MaxRect(); }
+	CameraIntrinsics Intrinsics() const { return CameraIntrinsics::For<G>(W, H); }
+};
+
+/**
+ * Same interface as VisionConfig with the values held at runtime, for
+ * resolutions that have no instantiation.
+ */
+struct RuntimeVisionConfig
+{
+	int width, height;
+	vector<Threshold> thresholds;
+	double degsVert, tapeHeight, tapeWidth;
+	int minRect, maxRect;
+	CameraIntrinsics intrinsics;
+
+	template <class T, class G>
+	static RuntimeVisionConfig For(int width, int height)
+	{
+		RuntimeVisionConfig c;
+		c.width = width;
+		c.height = height;
+		for(int i = 0; i < T::Count(); i++)
+			c.thresholds.push_back(T::Get(i));
+		c.degsVert = G::DegsVert();
+		c.tapeHeight = G::TapeHeight();
+		c.tapeWidth = G::TapeWidth();
+		c.minRect = G::MinRect();
+		c.maxRect = G::MaxRect();
+		c.intrinsics = CameraIntrinsics::For<G>(width, height);
+		return c;
+	}
+
+	int Width() const { return width; }
+	int Height() const { return height; }
+	int Thresholds() const { return thresholds.size(); }
+	const Threshold &GetThreshold(int i) const { return thresholds[i]; }
+	double DegsVert() const { return degsVert; }
+	double TapeHeight() const { return tapeHeight; }
+	double TapeWidth() const { return tapeWidth; }
+	int MinRect() const { return minRect; }
+	int MaxRect() const { return maxRect; }
+	CameraIntrinsics Intrinsics() const { return intrinsics; }
+};
+
+/**
+ * A threshold as the inner loop wants it: one unsigned compare per plane.
+ */
+struct PlaneRange
+{
+	unsigned rLo, rSpan, gLo, gSpan, bLo, bSpan;
+
+	PlaneRange(const Threshold &t):
+		rLo(t.plane1Low), rSpan(t.plane1High - t.plane1Low),
+		gLo(t.plane2Low), gSpan(t.plane2High - t.plane2Low),
+		bLo(t.plane3Low), bSpan(t.plane3High - t.plane3Low)
+	{
+	}
 
-// trigger release
-static SEM_ID releaseSem;
-static bool releaseSet;
-static bool intakeOff;
+	bool Contains(const RGBValue &p) const
+	{
+		return (unsigned)(p.R - rLo) <= rSpan && (unsigned)(p.G - gLo) <= gSpan && (unsigned)(p.B - bLo) <= bSpan;
+	}
+};
+
+/**
+ * Where the backboard tape is relative to the camera, from one frame.
+ */
+struct TargetPose
+{
+	double corners[4][2];   // top-left, top-right, bottom-right, bottom-left, pixels
+	double range;           // to the center of the tape, same units as the tape size
+	double bearing;         // radians, positive right
+	double viewAngle;       // radians between the line of sight and the backboard's normal
+};
+
+/**
+ * Least-squares fit of a = slope * b + offset to edge points (b, a).
+ */
+struct EdgeLine
+{
+	double n, sb, sa, sbb, sab;
+
+	EdgeLine(): n(0), sb(0), sa(0), sbb(0), sab(0) {}
+
+	void Add(double b, double a)
+	{
+		n++;
+		sb += b;
+		sa += a;
+		sbb += b * b;
+		sab += a * b;
+	}
+
+	bool Fit(double &slope, double &offset) const
+	{
+		double den = n * sbb - sb * sb;
+		if(n < 3 || den == 0)
+			return false;
+		slope = (n * sab - sb * sa) / den;
+		offset = (sa - slope * sb) / n;
+		return true;
+	}
+};
+
+/**
+ * Fit a line to each side of the particle inside rect in a run mask and
+ * intersect them, which puts the corners well below a pixel even though
+ * every edge point is whole.  The ends of each side are left out so
+ * rounded or clipped corners don't bend the fit.  Then solve for range,
+ * bearing and viewing angle from how tall each vertical side is, assuming
+ * the camera is level with no roll.
+ */
+static bool EstimatePose(const RunMask &mask, const Rect &rect, const CameraIntrinsics &k,
+		double tapeWidth, double tapeHeight, TargetPose &pose)
+{
+	EdgeLine left, right, top, bottom;
+	double ls, lo, rs, ro, ts, to, bs, bo;
+	int marginX = rect.width * 15 / 100;
+	int marginY = rect.height * 15 / 100;
+	int x0 = rect.left, x1 = rect.left + rect.width;
+	vector<int> first(rect.width, -1), last(rect.width, -1);
+	int x, y, n, i;
+
+	// left and right sides as x = slope * y + offset, noting the first and
+	// last row set in each column on the way
+	for(y = rect.top; y < rect.top + rect.height; y++)
+	{
+		const Run *r = mask.Row(y, n);
+		int l = x1, rr = x0 - 1;
+		for(i = 0; i < n; i++)
+		{
+			int a = max(r[i].x0, x0), b = min(r[i].x1, x1);
+			if(a >= b)
+				continue;
+			l = min(l, a);
+			rr = b - 1;
+			for(x = a; x < b; x++)
+			{
+				if(first[x - x0] < 0)
+					first[x - x0] = y;
+				last[x - x0] = y;
+			}
+		}
+		if(l == x1 || y < rect.top + marginY || y >= rect.top + rect.height - marginY)
+			continue;
+		left.Add(y, l - 0.5);
+		right.Add(y, rr + 0.5);
+	}
+	// top and bottom as y = slope * x + offset
+	for(x = x0 + marginX; x < x1 - marginX; x++)
+	{
+		if(first[x - x0] < 0)
+			continue;
+		top.Add(x, first[x - x0] - 0.5);
+		bottom.Add(x, last[x - x0] + 0.5);
+	}
+	if(!left.Fit(ls, lo) || !right.Fit(rs, ro) || !top.Fit(ts, to) || !bottom.Fit(bs, bo))
+		return false;
+
+	// x = vs * y + vo meets y = hs * x + ho
+	double vs[4] = {ls, rs, rs, ls}, vo[4] = {lo, ro, ro, lo};
+	double hs[4] = {ts, ts, bs, bs}, ho[4] = {to, to, bo, bo};
+	for(int i = 0; i < 4; i++)
+	{
+		double den = 1 - vs[i] * hs[i];
+		if(fabs(den) < 1e-6)
+			return false;
+		pose.corners[i][0] = (vs[i] * ho[i] + vo[i]) / den;
+		pose.corners[i][1] = hs[i] * pose.corners[i][0] + ho[i];
+	}
+
+	// each vertical side's depth from its height in pixels
+	double hl = pose.corners[3][1] - pose.corners[0][1];
+	double hr = pose.corners[2][1] - pose.corners[1][1];
+	if(hl <= 0 || hr <= 0)
+		return false;
+	double zl = k.fy * tapeHeight / hl;
+	double zr = k.fy * tapeHeight / hr;
+	double xl = ((pose.corners[0][0] + pose.corners[3][0]) / 2 - k.cx) * zl / k.fx;
+	double xr = ((pose.corners[1][0] + pose.corners[2][0]) / 2 - k.cx) * zr / k.fx;
+
+	// the sides have to be about a tape width apart or this isn't the backboard
+	double dx = xr - xl, dz = zr - zl;
+	if(fabs(sqrt(dx * dx + dz * dz) - tapeWidth) > tapeWidth / 4)
+		return false;
+
+	double xc = (xl + xr) / 2, zc = (zl + zr) / 2;
+	pose.range = sqrt(xc * xc + zc * zc);
+	pose.bearing = atan2(xc, zc);
+	// from the backboard's normal round to the line of sight, positive
+	// when the right side is further away
+	pose.viewAngle = atan2(dz * zc + dx * xc, dx * zc - dz * xc);
+	return true;
+}
+
+/**
+ * Finds the rectangles in one decoded frame.  Create() hands out the
+ * pipeline specialized for the frame's resolution and for a camera's
+ * thresholds T and geometry G.
+ */
+class VisionDetector
+{
+public:
+	virtual ~VisionDetector() {}
+	virtual bool Handles(int width, int height) const = 0;
+	virtual void Detect(VisionFrame *frame) = 0;
+
+	template <class T, class G>
+	static VisionDetector *Create(int width, int height);
+};
+
+/**
+ * Threshold, convex hull, particle filter and distance for one
+ * configuration.  The distance scale is worked out once up front, so
+ * there is no trig per particle, and with a compile-time config the
+ * threshold loop runs over a constant image width.  The threshold goes
+ * straight to runs and everything after it works on those, so past the
+ * one pass over the pixels the cost follows the size of what was lit.
+ */
+template <class Config>
+class VisionPipeline : public VisionDetector
+{
+	Config config;
+	vector<PlaneRange> ranges;
+	double distanceScale;   // distance = distanceScale / rect height
+	CameraIntrinsics intrinsics;
+	RunMask mask, hull, big, filtered;
+	vector<MaskParticle> reports;
+
+	// unrolled by four, skipping quads that don't change whether we are
+	// in a run; the tail loop folds away for fixed widths
+	void ThresholdImage(const PlaneRange &range, const ImageInfo &src, RunMask &dst)
+	{
+		const int w = config.Width();
+		const int h = config.Height();
+		dst.Reset(w, h);
+		for(int y = 0; y < h; y++)
+		{
+			const RGBValue *p = (const RGBValue *)src.imageStart + y * src.pixelsPerLine;
+			int start = -1;
+			int x = 0;
+			for(; x + 4 <= w; x += 4)
+			{
+				int quad = range.Contains(p[x]) | range.Contains(p[x + 1]) << 1 |
+						range.Contains(p[x + 2]) << 2 | range.Contains(p[x + 3]) << 3;
+				if(quad == (start < 0 ? 0 : 15))
+					continue;
+				for(int i = 0; i < 4; i++)
+				{
+					if((quad >> i & 1) == (start < 0))
+					{
+						if(start < 0)
+						{
+							start = x + i;
+						}
+						else
+						{
+							dst.Add(start, x + i);
+							start = -1;
+						}
+					}
+				}
+			}
+			for(; x < w; x++)
+			{
+				if(range.Contains(p[x]) == (start < 0))
+				{
+					if(start < 0)
+					{
+						start = x;
+					}
+					else
+					{
+						dst.Add(start, x);
+						start = -1;
+					}
+				}
+			}
+			if(start >= 0)
+				dst.Add(start, w);
+			dst.EndRow();
+		}
+	}
+
+public:
+	VisionPipeline(const Config &c = Config()):
+		config(c)
+	{
+		for(int i = 0; i < config.Thresholds(); i++)
+			ranges.push_back(PlaneRange(config.GetThreshold(i)));
+		distanceScale = config.TapeHeight() * config.Height() / 2 / tan(config.DegsVert() * 3.141592653589 / 180);
+		intrinsics = config.Intrinsics();
+	}
+
+	bool Handles(int width, int height) const
+	{
+		return width == config.Width() && height == config.Height();
+	}
+
+	void Detect(VisionFrame *frame)
+	{
+		bool found = false;
+		TargetDetection d;
+		ImageInfo src;
+		TargetPose pose;
+		Rect rect;
+		unsigned i, j;
+
+		if(!imaqGetImageInfo(frame->image->GetImaqImage(), &src))
+		{
+			Log(LOG_IMAGE_ERROR);
+			return;
+		}
+
+		// loop through our threshold values
+		for(i = 0; i < ranges.size() && !found; i++)
+		{
+			ThresholdImage(ranges[i], src, mask);
+			mask.ConvexHull(hull, false);  // fill in partial and full rectangles
+			hull.ParticleFilter(big, config.MinRect(), config.MaxRect(),
+					config.MinRect(), config.MaxRect(), false);  // find the rectangles
+			big.RemoveSmallObjects(filtered, false, 2);  // remove small objects (noise)
+			filtered.GetParticles(reports, false);  // get the results, largest first
+
+			// loop through the reports, keeping every basket for the tracker
+			for (j = 0; j < reports.size(); j++)
+			{
+				const MaskParticle &r = reports[j];
+				rect.left = r.left;
+				rect.top = r.top;
+				rect.width = r.Width();
+				rect.height = r.Height();
+				d.x = r.CenterX();
+				d.y = r.CenterY();
+				d.width = rect.width;
+				d.height = rect.height;
+				d.left = rect.left;
+				d.top = rect.top;
+				d.distance = distanceScale / rect.height;
+				d.imageWidth = config.Width();
+				d.posed = EstimatePose(filtered, rect, intrinsics,
+						config.TapeWidth(), config.TapeHeight(), pose);
+				if(d.posed)
+				{
+					// the corners beat the bounding box height for range
+					d.distance = pose.range;
+					d.bearing = pose.bearing;
+					d.viewAngle = pose.viewAngle;
+				}
+				else
+				{
+					d.bearing = atan((d.x - intrinsics.cx) / intrinsics.fx);
+					d.viewAngle = 0;
+				}
+				frame->detections.push_back(d);
+				frame->threshold = i;
+				found = true;
+			}
+
+			if(!reports.size())
+			{
+				Log(LOG_NO_PARTICLES);
+			}
+			else
+			{
+				Log(LOG_PARTICLES);
+			}
+		}
+	}
+};
+
+template <class T, class G>
+VisionDetector *VisionDetector::Create(int width, int height)
+{
+	if(width == 320 && height == 240)
+		return new VisionPipeline<VisionConfig<320, 240, T, G> >();
+	if(width == 160 && height == 120)
+		return new VisionPipeline<VisionConfig<160, 120, T, G> >();
+	Log(LOG_NO_PIPELINE, width, height);
+	return new VisionPipeline<RuntimeVisionConfig>(RuntimeVisionConfig::For<T, G>(width, height));
+}
+
+/**
+ * One camera feeding the vision pipeline: where its frames come from, how
+ * its detector is built, how it is mounted and what it is tracking.
+ */
+struct VisionCamera
+{
+	const char *name;
+	VisionSource *source;
+	CameraGovernor *governor;       // NULL when the source can't be tuned
+	VisionDetector *(*createDetector)(int width, int height);
+	double yaw;                     // radians the camera points right of the shooter
+	int decodeScale;                // 1 for NI's full size decode, or 2, 4 or 8; the governor's if any
+	TargetTracker tracker;
+	unsigned seq;                   // next frame captured
+	unsigned lastSeq;               // last frame targeted
+	bool targeted;
+	bool locked;                    // target is current as of lockTime
+	TargetTrack target;
+	double lockTime;
+
+	VisionCamera(const char *name, VisionSource *source, CameraGovernor *governor,
+			VisionDetector *(*createDetector)(int, int), double yaw, int decodeScale):
+		name(name),
+		source(source),
+		governor(governor),
+		createDetector(createDetector),
+		yaw(yaw),
+		decodeScale(decodeScale),
+		seq(0),
+		lastSeq(0),
+		targeted(false),
+		locked(false),
+		lockTime(0)
+	{
+	}
+
+	int DecodeScale() const
+	{
+		return governor ? governor->DecodeScale() : decodeScale;
+	}
+};
+
+static vector<VisionCamera *> g_cameras;
 
-// auto aim
-static SEM_ID autoAimSem;
-static bool g_autoAimSet;
-static double g_targetDistance;
-typedef enum {TARGET_LEFT, TARGET_RIGHT, TARGET_CENTER, TARGET_NONE} targetAlignment;
-static targetAlignment g_targetAlign;
-static RobotDrive *g_sparky;
- 
 /**
  * Sparky class.  Describes the 2012 FRC robot.
  */
@@ -42,7 +1713,9 @@ class Sparky : public SimpleRobot
 {
 	RobotDrive sparky;
 	Joystick stick1, stick2, stick3;
-	Task targeting, blinkyLights, autoAim;
+	Task targeting, visionCapture, blinkyLights, autoAim, logging;
+	Task *visionWorkers[2];
+	vector<Task *> started;         // Tasks StartTask has spawned, to resume from then on
 	DigitalInput top, middle, shooter, trigger, bridgeArmUp, bridgeArmDown;
 	DriverStation *ds;
 	DriverStationLCD *dsLCD;
@@ -51,24 +1724,17 @@ class Sparky : public SimpleRobot
 	Relay release, lights;
 	Encoder tension;
 	
-	// constants
-	static const double MOTOR_OFF = 0.0;
-	static const double TENSION_BRAKE = -0.06;
-	static const double ARM_SPEED_COARSE = 0.5;
-	static const double ARM_SPEED_COARSE_LOAD = -0.5;
-	static const double ARM_SPEED_COARSE_UNLOAD = 0.5;
-	static const double ARM_SPEED_FINE_LOAD = -0.3;
-	static const double ARM_SPEED_FINE_UNLOAD = 0.2;
-	static const double ARM_SPEED_FULL_LOAD = -1.0;
-	static const double ARM_SPEED_FULL_UNLOAD = 1.0;
-	static const double ARM_ZERO_THRESH = 75;
-	static const double INTAKE_LOAD = 1.0;
-	static const double INTAKE_UNLOAD = -1.0;
-	static const double INTAKE_OFF = 0.0;
-	static const double BRIDGE_ARM_DOWN = 0.9;
-	static const double BRIDGE_ARM_UP = -0.9;
-	static const double BRIDGE_ARM_OFF = 0.0;
-	static const double AUTO_AIM_SPEED = 0.2;
+	// constants, the rest are in TeleopLogic.h
+	static const double AUTO_AIM_SPEED = 0.2;     // most the auto aim turns at
+	static const double AUTO_AIM_MIN_SPEED = 0.1; // least that still turns the robot
+	static const double AUTO_AIM_GAIN = 1.0;      // turn speed per radian of bearing
+	static const double AUTO_TARGET_WAIT = 1.0;   // seconds autonomous waits for a distance
+	static const int VISION_WORKERS = sizeof(visionWorkers) / sizeof(visionWorkers[0]);
+	static const double TARGET_STALE = 0.5;       // seconds a camera's lock counts in the merge
+	static const int LOG_PRIORITY = 150;          // below every other Task
+	static const int LOG_BATCH = 32;              // lines written between checks for more
+	static const double LOG_PERIOD = 0.05;        // seconds the logging Task sleeps when idle
+	static const int DECODE_COMPARE_EVERY = 50;   // frames between timing NI's full decode too
 
 public:
 	Sparky(void):
@@ -77,8 +1743,10 @@ public:
 		stick2(2),
 		stick3(3),
 		targeting("targeting", (FUNCPTR)Targeting, 102),
+		visionCapture("visionCapture", (FUNCPTR)VisionCapture, 102),
 		blinkyLights("blinkyLights", (FUNCPTR)BlinkyLights, 103),
 		autoAim("autoAim", (FUNCPTR)AutoAim),
+		logging("logging", (FUNCPTR)Logging, LOG_PRIORITY),
 		top(13),
 		middle(14),
 		shooter(12),
@@ -95,12 +1763,27 @@ public:
 		lights(4),
 		tension(1,2)  // measures tension-revolutions 
 	{
-		printf("Sparky: start\n");
-		encPos = 0;
-		armSet = false;
+		g_logSem = semMCreate(SEM_Q_PRIORITY | SEM_DELETE_SAFE | SEM_INVERSION_SAFE);
+		g_log = new LogBuffer(LOG_SITES, LOG_SITE_COUNT);
+		g_trace = new TraceBuffer();
+		logging.Start();
+		Log(LOG_SPARKY_START);
 		g_autoAimSet = false;
 		g_targetDistance = 0;
+		g_targetBearing = 0;
 		g_targetAlign = TARGET_NONE;
+		g_visionWork = new VisionWork();
+		g_resultQueue = new VisionQueue("result", 4);
+		g_visionStream = new VisionStream(VISION_STREAM_HOST, VISION_PORT, 0.5);
+		g_trackPolicy = TRACK_LOWEST;
+		g_trackId = 0;
+		g_trackCamera = 0;
+		g_targetCamera = 0;
+		for(int i = 0; i < VISION_WORKERS; i++)
+		{
+			static const char *names[] = {"visionWorker0", "visionWorker1"};
+			visionWorkers[i] = new Task(names[i], (FUNCPTR)VisionWorker, 102);
+		}
 		g_sparky = &sparky;
 		tension.Reset();
 		tension.Start();
@@ -113,32 +1796,100 @@ public:
 		g_middle = &middle;
 		g_shooter = &shooter;
 		Wait(5);
-		/*
-		camera = &AxisCamera::GetInstance("10.3.84.11");
-		camera->WriteResolution(AxisCameraParams::kResolution_640x480);
-		*/
-		camera = &AxisCamera::GetInstance("10.3.84.12");
-		camera->WriteResolution(AxisCameraParams::kResolution_320x240);
+		AxisCamera *camera = &AxisCamera::GetInstance("10.3.84.12");
 		camera->WriteWhiteBalance(AxisCameraParams::kWhiteBalance_Hold);
 		camera->WriteExposureControl(AxisCameraParams::kExposure_Hold);
 		camera->WriteColorLevel(100);
-	    camera->WriteCompression(30);
 		camera->WriteBrightness(30);
-		camera->WriteMaxFPS(10);
+		// the shooter's camera comes first and gets twice the workers' time;
+		// 2-10 fps, compression 30-60, 320x240 decoded by NI at full size or
+		// by JpegDecoder at 1/2 to 160x120, 0.1 s per frame.  The side camera
+		// is decoded at half size, to 320x240
+		AddCamera(new VisionCamera("front", new AxisVisionSource(camera),
+				new CameraGovernor(camera, 2, 10, 30, 60, AxisCameraParams::kResolution_320x240, 1, 2, 0.1),
+				&VisionDetector::Create<LedThresholds, SparkyGeometry>, 0, 1), 2, 0.15);
+		if(SIDE_CAMERA)
+		{
+			AddCamera(new VisionCamera("side", new MjpegVisionSource(SIDE_CAMERA_HOST, 640, 480, 5), NULL,
+					&VisionDetector::Create<LedThresholds, SparkyGeometry>, 0, 2), 1, 0.4);
+		}
 		Wait(5);
-		printf("Sparky: done\n");
+		Log(LOG_SPARKY_DONE);
 	}
 	
 	/**
-	 * When disabled, suspend the targeting Task.
+	 * Register a camera with the vision workers.
 	 */
-	void Disabled()
+	static void AddCamera(VisionCamera *camera, double share, double latencyTarget)
+	{
+		g_cameras.push_back(camera);
+		g_visionWork->AddCamera(share, latencyTarget);
+	}
+	
+	/**
+	 * Start or stop every vision Task.
+	 */
+	void StartVision()
 	{
-		if(targeting.IsReady() && !targeting.IsSuspended())
-			targeting.Suspend();
+		StartTask(targeting);
+		for(int i = 0; i < VISION_WORKERS; i++)
+			StartTask(*visionWorkers[i]);
+		StartTask(visionCapture);
 		
-		if(blinkyLights.IsReady() && !blinkyLights.IsSuspended())
-			blinkyLights.Suspend();
+		// after the resume, since a Task may have been suspended holding
+		// the governor's lock
+		for(unsigned i = 0; i < g_cameras.size(); i++)
+			if(g_cameras[i]->governor)
+				g_cameras[i]->governor->Restart();
+	}
+	
+	void SuspendVision()
+	{
+		SuspendTask(visionCapture);
+		for(int i = 0; i < VISION_WORKERS; i++)
+			SuspendTask(*visionWorkers[i]);
+		SuspendTask(targeting);
+	}
+	
+	/**
+	 * When disabled, suspend the vision Tasks.
+	 */
+	void Disabled()
+	{
+		SuspendVision();
+		SuspendTask(blinkyLights);
+	}
+	
+	bool Started(Task &t) const
+	{
+		return find(started.begin(), started.end(), &t) != started.end();
+	}
+	
+	/**
+	 * Start a Task the first time, resume it afterwards.  Start spawns a
+	 * new task every time, so it must only happen once.
+	 */
+	void StartTask(Task &t)
+	{
+		if(Started(t))
+		{
+			t.Resume();
+		}
+		else
+		{
+			t.Start();
+			started.push_back(&t);
+		}
+	}
+	
+	/**
+	 * Suspend a Task once it has been started, whether it is running or
+	 * waiting.
+	 */
+	void SuspendTask(Task &t)
+	{
+		if(Started(t))
+			t.Suspend();
 	}
 	
 	/**
@@ -149,504 +1900,554 @@ public:
 	}
 	
 	/**
-	 * Score two baskets from the key.
+	 * Score two baskets from the key, with the tension planned from the
+	 * target distance when vision has one.
 	 */
 	void Autonomous(void)
 	{
-		printf("Autonomous: start\n");
+		Log(LOG_AUTONOMOUS_START);
+		ShotTable shots;
 		sparky.SetSafetyEnabled(false);
-		/*
-		if(targeting.IsSuspended())
-			targeting.Resume();
-		else
-			targeting.Start();
-	    */
+		Log(LOG_AUTONOMOUS_LEARNED, shots.ReadLog(SHOT_LOG));
+		StartVision();
 
 		if(IsAutonomous() && IsEnabled())
 		{
 			if(ds->GetDigitalIn(1))
 			{
-				printf("Waiting 1...");
+				Log(LOG_AUTONOMOUS_WAITING, 1);
 				Wait(3);
-				printf("Waiting done!\n");
+				Log(LOG_AUTONOMOUS_WAITED);
 			}
 			else if(ds->GetDigitalIn(2))
 			{
-				printf("Waiting 2...");
+				Log(LOG_AUTONOMOUS_WAITING, 2);
 				Wait(5);
-				printf("Waiting done!\n");
+				Log(LOG_AUTONOMOUS_WAITED);
 			}
 			else if(ds->GetDigitalIn(3))
 			{
-				printf("Waiting 3...");
+				Log(LOG_AUTONOMOUS_WAITING, 3);
 				Wait(7);
-				printf("Waiting done!\n");
+				Log(LOG_AUTONOMOUS_WAITED);
 			}
 			
-			int p = 190;
+			int p = PlanShot(shots, ARM_PRESET_AUTONOMOUS);
 			
 			ArmToPosition(p);
 			dsLCD->PrintfLine(DriverStationLCD::kUser_Line4, "encoder: %d", tension.Get());
 			dsLCD->PrintfLine(DriverStationLCD::kUser_Line6, "s: %d, t: %d, m: %d", shooter.Get(), top.Get(), middle.Get());
 			dsLCD->UpdateLCD();
-			ReleaseNotifier(this);
+			Release();
+			p = PlanShot(shots, p);
 			ArmToPositionNoEye(p);
 			dsLCD->PrintfLine(DriverStationLCD::kUser_Line4, "encoder: %d", tension.Get());
 			dsLCD->PrintfLine(DriverStationLCD::kUser_Line6, "s: %d, t: %d, m: %d", shooter.Get(), top.Get(), middle.Get());
 			dsLCD->UpdateLCD();
-			ReleaseNotifier(this);
+			Release();
 			while(IsAutonomous() && IsEnabled())
 			{
 				Wait(0.05);
 			}
 		}
-		//targeting.Suspend();
-		printf("Autonomous: stop\n");
+		SuspendVision();
+		Log(LOG_AUTONOMOUS_STOP);
+	}
+	
+	/**
+	 * Tension for the current target distance, waiting a moment for vision
+	 * to lock.  Without a target the fallback is used.
+	 */
+	int PlanShot(const ShotTable &shots, int fallback)
+	{
+		Timer t;
+		double distance;
+		int p;
+		t.Start();
+		// Targeting may zero it at any time, so read it once per look
+		while((distance = g_targetDistance) <= 0 && t.Get() < AUTO_TARGET_WAIT && IsEnabled())
+		{
+			Wait(0.05);
+		}
+		if(distance <= 0)
+		{
+			Log(LOG_PLAN_NO_TARGET, fallback);
+			return fallback;
+		}
+		p = shots.Lookup(distance);
+		Log(LOG_PLAN_SHOT, distance, p);
+		return p;
+	}
+	
+	/**
+	 * Tele-op period.  The decisions live in TeleopLogic; this loop reads the
+	 * inputs, steps the logic and applies its commands, recording both when
+	 * DS digital input 8 is on.
+	 */
+	void OperatorControl(void)
+	{
+		Log(LOG_TELEOP_START);
+		TeleopLogic logic;
+		TeleopInputs in;
+		TeleopOutputs out;
+		TraceRecord record;
+		bool trace = false;
+		unsigned lost;
+		Timer teleopTimer;
+		sparky.SetSafetyEnabled(false);
+		StartVision();
+		
+		StartTask(blinkyLights);
+		
+		if(ds->GetDigitalIn(8))
+		{
+			trace = g_trace->Open(TRACE_FILE);
+			if(!trace)
+				Log(LOG_TELEOP_NO_TRACE, TRACE_FILE);
+		}
+		
+		Log(LOG_TELEOP_LEARNED, logic.Planner().Table().ReadLog(SHOT_LOG));
+		if(trace && !logic.Planner().Table().Save(TRACE_SHOT_TABLE))
+			Log(LOG_TELEOP_NO_TABLE, TRACE_SHOT_TABLE);
+		
+		teleopTimer.Start();
+		ReadInputs(in, teleopTimer);
+		logic.Reset(in.t);
+
+		while (IsOperatorControl() && IsEnabled())
+		{
+			ReadInputs(in, teleopTimer);
+			logic.Step(in, out);
+			WriteOutputs(out);
+			if(trace)
+			{
+				record.in = in;
+				record.out = out;
+				g_trace->Put(record);
+			}
+			if(out.shot != SHOT_NONE)
+			{
+				ShotTable::AppendLog(SHOT_LOG, logic.Planner().ShotDistance(), logic.Planner().ShotTension(), out.shot);
+			}
+			
+			// target selection
+			if(stick1.GetRawButton(9))
+			{
+				g_trackPolicy = TRACK_LOWEST;
+			}
+			else if(stick1.GetRawButton(10))
+			{
+				g_trackPolicy = TRACK_CENTERMOST;
+			}
+			else if(stick1.GetRawButton(11) && g_trackPolicy != TRACK_ID)
+			{
+				TargetTrack t;
+				int c = g_targetCamera;
+				if(g_cameras[c]->tracker.Select(g_trackPolicy, g_trackId, t))
+				{
+					g_trackId = t.id;
+					g_trackCamera = c;
+					g_trackPolicy = TRACK_ID;
+				}
+			}
+			
+			// the same lines as autonomous; Targeting has 1, 2 and 5
+			dsLCD->PrintfLine(DriverStationLCD::kUser_Line4, "encoder: %d", tension.Get());
+			dsLCD->PrintfLine(DriverStationLCD::kUser_Line6, "s: %d, t: %d, m: %d", shooter.Get(), top.Get(), middle.Get());
+			dsLCD->UpdateLCD();
+			
+			Wait(0.005); // wait for a motor update time
+		}
+		if(trace && (lost = g_trace->Close()) != 0)
+			Log(LOG_TELEOP_TRACE_LOST, lost);
+		autoAim.Stop();
+		SuspendVision();
+		SuspendTask(blinkyLights);
+		Log(LOG_TELEOP_STOP);
+	}
+	
+	/**
+	 * Sample everything TeleopLogic looks at.  Time is truncated to whole
+	 * microseconds and the target distance rounded to the thousandths the
+	 * trace keeps, so a replayed trace sees exactly what the robot saw.
+	 */
+	void ReadInputs(TeleopInputs &in, Timer &t)
+	{
+		unsigned i;
+		in.t = (unsigned long)(t.Get() * 1e6) / 1e6;
+		in.stick1 = in.stick2 = in.stick3 = 0;
+		for(i = 1; i <= 12; i++)
+		{
+			in.stick1 |= stick1.GetRawButton(i) << (i - 1);
+			in.stick2 |= stick2.GetRawButton(i) << (i - 1);
+			in.stick3 |= stick3.GetRawButton(i) << (i - 1);
+		}
+		in.dsIn = 0;
+		for(i = 1; i <= 8; i++)
+		{
+			in.dsIn |= ds->GetDigitalIn(i) << (i - 1);
+		}
+		in.top = top.Get();
+		in.middle = middle.Get();
+		in.shooter = shooter.Get();
+		in.trigger = trigger.Get();
+		in.bridgeArmUp = bridgeArmUp.Get();
+		in.bridgeArmDown = bridgeArmDown.Get();
+		in.tension = tension.Get();
+		in.autoAimSet = g_autoAimSet;
+		in.enabled = IsEnabled();
+		in.targetDistance = TraceRecord::Milli(g_targetDistance) / 1000.0;
+	}
+	
+	/**
+	 * Apply TeleopLogic's commands to the hardware.
+	 */
+	void WriteOutputs(const TeleopOutputs &out)
+	{
+		if(out.drive == DRIVE_ARCADE)
+		{
+			sparky.ArcadeDrive(stick1);
+		}
+		else if(out.drive == DRIVE_TANK)
+		{
+			sparky.TankDrive(stick2, stick1);
+		}
+		else if(out.drive == DRIVE_OFF)
+		{
+			sparky.TankDrive(MOTOR_OFF, MOTOR_OFF);
+		}
+		if(out.startAutoAim)
+		{
+			g_autoAimSet = true;
+			autoAim.Start();
+		}
+		if(out.resetTension)
+		{
+			tension.Reset();
+		}
+		arm.Set(out.arm);
+		floorPickup.Set(out.floorPickup);
+		shooterLoader.Set(out.shooterLoader);
+		bridgeArm.Set(out.bridgeArm);
+		release.Set(out.release == RELAY_REVERSE ? Relay::kReverse :
+				out.release == RELAY_FORWARD ? Relay::kForward : Relay::kOff);
+	}
+	
+	/**
+	 * Vision capture.  Copies each fresh JPEG off every camera and hands it
+	 * to the worker pool.
+	 */
+	static int VisionCapture(void)
+	{
+		Log(LOG_CAPTURE_START);
+		DriverStation *ds = DriverStation::GetInstance();
+		VisionFrame *frame = NULL;
+		bool any;
+		
+		while(true)
+		{
+			if(ds->GetDigitalIn(5))
+			{
+				Wait(1.0);
+				continue;
+			}
+			any = false;
+			for(unsigned i = 0; i < g_cameras.size(); i++)
+			{
+				VisionCamera *cam = g_cameras[i];
+				bool fresh = cam->source->IsFreshImage();
+				if(cam->governor)
+					cam->governor->Polled(fresh);
+				if(!fresh)
+					continue;
+				
+				frame = new VisionFrame();
+				frame->camera = i;
+				frame->seq = cam->seq++;
+				frame->timestamp = GetTime();
+				if(cam->source->CopyJPEG(&frame->jpeg, frame->jpegSize, frame->jpegBufferSize) <= 0)
+				{
+					Log(LOG_COPY_FAILED, cam->name);
+					delete frame;
+					continue;
+				}
+				g_visionWork->Put(frame);
+				any = true;
+			}
+			if(!any)
+				Wait(0.01);
+		}
+		Log(LOG_CAPTURE_STOP);
+		
+		return 0;
 	}
 	
 	/**
-	 * Tele-op period.
+	 * Vision worker, one of a pool.  Decodes whichever frame the scheduler
+	 * hands it and finds the rectangles with the pipeline built for that
+	 * camera and resolution.  Detectors hold working images, so each worker
+	 * keeps its own.
 	 */
-	void OperatorControl(void)
+	static int VisionWorker(void)
 	{
-		printf("OperatorControl: start\n");
-		Notifier armToPositionNotifier(ArmToPositionNotifier, this);
-		Notifier releaseNotifier(ReleaseNotifier, this);
-		Timer armTimer;
-		bool armUp = false;
-		bool armDown = false;
-		int lastPosition = 0;
-		sparky.SetSafetyEnabled(false);
-		armSet = false;
-		releaseSet = false;
-		intakeOff = false;
-		
-		if(targeting.IsSuspended())
-			targeting.Resume();
-		else
-			targeting.Start();
-		
-		if(blinkyLights.IsSuspended())
-			blinkyLights.Resume();
-		else
-			blinkyLights.Start();
+		Log(LOG_WORKER_START);
+		VisionFrame *frame = NULL;
+		vector<VisionDetector *> detectors(g_cameras.size(), (VisionDetector *)NULL);
+		JpegDecoder *decoder = new JpegDecoder();
+		int decoded = 0;
+		int scale;
+		bool scaled;
+		DriverStation *ds = DriverStation::GetInstance();
+		Timer stageTimer;
+		stageTimer.Start();
 		
-		armTimer.Start();
-
-		while (IsOperatorControl() && IsEnabled())
+		while(true)
 		{
-			// drive
-			if(!g_autoAimSet)
-			{
-				if(stick1.GetTrigger() && !stick2.GetTrigger())
-				{
-					sparky.ArcadeDrive(stick1);
-				}
-				else if(stick1.GetTrigger() && stick2.GetTrigger())
-				{
-					sparky.TankDrive(stick2, stick1);
-				}
-				else if(stick1.GetRawButton(8) && !ds->GetDigitalIn(5))
-				{
-					g_autoAimSet = true;
-					autoAim.Start();
-				}
-				else
-				{
-					sparky.TankDrive(MOTOR_OFF, MOTOR_OFF);
-				}
-			}
+			frame = g_visionWork->Get(WAIT_FOREVER);
+			VisionCamera *cam = g_cameras[frame->camera];
+			VisionDetector *&detector = detectors[frame->camera];
 			
-			// bridge arm
-			if(stick1.GetRawButton(6))
-			{
-				if(!bridgeArmDown.Get())
-				{
-					armDown = true;
-				}
-				if(armUp && !bridgeArmUp.Get())
-				{
-					armUp = false;
-				}
-				if(!armDown || ds->GetDigitalIn(6))
-				{
-					bridgeArm.Set(BRIDGE_ARM_UP);
-				}
-				else
-				{
-					bridgeArm.Set(BRIDGE_ARM_OFF);
-				}
-			}
-			else if(stick1.GetRawButton(7))
+			// decode, at the camera's reduced size when we can
+			stageTimer.Reset();
+			frame->image = new RGBImage();
+			scale = cam->DecodeScale();
+			scaled = DecodeScaled(decoder, scale, frame);
+			if(!scaled)
 			{
-				if(!bridgeArmUp.Get())
-				{
-					armUp = true;
-				}
-				if(armDown && !bridgeArmDown.Get())
-				{
-					armDown = false;
-				}
-				if(!armUp || ds->GetDigitalIn(6))
-				{
-					bridgeArm.Set(BRIDGE_ARM_DOWN);
-				}
-				else
-				{
-					bridgeArm.Set(BRIDGE_ARM_OFF);
-				}
+				Priv_ReadJPEGString_C(frame->image->GetImaqImage(), (unsigned char *)frame->jpeg, frame->jpegSize);
 			}
-			else
+			frame->decodeTime = stageTimer.Get();
+			if(scaled && DECODE_COMPARE_EVERY && ++decoded % DECODE_COMPARE_EVERY == 0)
 			{
-				bridgeArm.Set(BRIDGE_ARM_OFF);
+				// what the same frame costs the old way, left out of its time
+				RGBImage full;
+				stageTimer.Reset();
+				Priv_ReadJPEGString_C(full.GetImaqImage(), (unsigned char *)frame->jpeg, frame->jpegSize);
+				Log(LOG_DECODE_COMPARE, cam->name, scale, frame->decodeTime, stageTimer.Get());
 			}
+			delete [] frame->jpeg;
+			frame->jpeg = NULL;
 			
-			// shooter arm
-			if(!armSet)
+			if(frame->image->GetWidth() == 0 || frame->image->GetHeight() == 0)
 			{
-				// zero encoder
-				if(ds->GetDigitalIn(4))
-				{
-					if(stick3.GetRawButton(8))
-					{
-						tension.Reset();
-					}
-				}
-				
-				// coarse adjustment
-				if(stick3.GetRawButton(3))
-				{
-					if(tension.Get() > 0 || ds->GetDigitalIn(4))
-					{
-						arm.Set(ARM_SPEED_COARSE_UNLOAD);
-					}
-				}
-				else if(stick3.GetRawButton(2) && shooter.Get())
-				{
-					arm.Set(ARM_SPEED_COARSE_LOAD);
-				}
-				// fine adjustment
-				else if(stick3.GetRawButton(5) && shooter.Get())
-				{
-					arm.Set(ARM_SPEED_FINE_LOAD);
-				}
-				else if(stick3.GetRawButton(4))
-				{
-					if(tension.Get() > 0 || ds->GetDigitalIn(4))
-					{
-						arm.Set(ARM_SPEED_FINE_UNLOAD);
-					}
-				}
-				// move to preset
-				else if(stick3.GetRawButton(9))
-				{
-					encPos = 115;
-					armSet = true;
-					armSpeed = ARM_SPEED_COARSE;
-					armToPositionNotifier.StartSingle(0);
-				}
-				else if(stick3.GetRawButton(8))
-				{
-					encPos = 0;
-					armSet = true;
-					armSpeed = ARM_SPEED_FULL_UNLOAD;
-					armToPositionNotifier.StartSingle(0);
-				}
-				else if(stick3.GetRawButton(10))
-				{
-					encPos = 175;
-					armSet = true;
-					armSpeed = ARM_SPEED_COARSE;
-					armToPositionNotifier.StartSingle(0);
-				}
-				else if(stick3.GetRawButton(11))
-				{
-					encPos = lastPosition;
-					armSet = true;
-					armSpeed = ARM_SPEED_COARSE;
-					armToPositionNotifier.StartSingle(0);
-				}
-				else
-				{
-					arm.Set(TENSION_BRAKE); // brake spool
-				}
+				Log(LOG_NO_SIZE, cam->name);
+				g_visionWork->Done(frame, frame->decodeTime, GetTime() - frame->timestamp);
+				delete frame;
+				continue;
 			}
 			
-			// make sure that ball isn't settling in the arm
-			if(shooter.Get())
+			// detect
+			stageTimer.Reset();
+			frame->imageWidth = frame->image->GetWidth();
+			frame->imageHeight = frame->image->GetHeight();
+			
+			// the camera governor may have changed the decode scale
+			if(!detector || !detector->Handles(frame->imageWidth, frame->imageHeight))
 			{
-				armTimer.Reset();
+				delete detector;
+				detector = cam->createDetector(frame->imageWidth, frame->imageHeight);
 			}
+			detector->Detect(frame);
 			
-			// ball loading
-			if(!intakeOff)
+			// debug thumbnail, rate limited
+			if(ds->GetDigitalIn(7))
 			{
-				if(stick3.GetRawButton(6))
-				{
-					if(shooter.Get() && top.Get() && middle.Get())
-					{
-						floorPickup.Set(INTAKE_OFF);
-					}
-					else if(top.Get() && middle.Get() && tension.Get() > ARM_ZERO_THRESH)
-					{
-						floorPickup.Set(INTAKE_OFF);
-					}
-					else
-					{
-						floorPickup.Set(INTAKE_LOAD);
-					}
-					if(!shooter.Get() && tension.Get() < ARM_ZERO_THRESH && armTimer.Get() > 1.0)
-					{
-						shooterLoader.Set(INTAKE_LOAD);
-					}
-					else if(!top.Get() && shooter.Get())
-
-					{
-						shooterLoader.Set(INTAKE_LOAD);
-					}
-					else if(!top.Get())
-					{
-						shooterLoader.Set(INTAKE_LOAD);
-					}
-					else
-					{
-						shooterLoader.Set(INTAKE_OFF);
-					}
-				}
-				else if(stick3.GetRawButton(7))
-				{
-					floorPickup.Set(INTAKE_UNLOAD);
-					shooterLoader.Set(INTAKE_UNLOAD);
-				}
-				else
-				{
-					floorPickup.Set(INTAKE_OFF);
-					shooterLoader.Set(INTAKE_OFF);
-				}
+				g_visionStream->SendFrame(frame->camera, frame->seq, frame->image, frame->detections, GetTime());
 			}
+			
+			// targeting only needs the detections
+			delete frame->image;
+			frame->image = NULL;
+			frame->detectTime = stageTimer.Get();
+			g_visionWork->Done(frame, frame->decodeTime + frame->detectTime, GetTime() - frame->timestamp);
+			g_resultQueue->Put(frame);
+		}
+		Log(LOG_WORKER_STOP);
 		
-			// release
-			if(!releaseSet)
+		return 0;
+	}
+	
+	/**
+	 * Decode frame's JPEG straight into its image at 1/scale, skipping the
+	 * full size decode.  False when the scale is 1 or the file is one
+	 * JpegDecoder doesn't handle, which leaves it to NI.
+	 */
+	static bool DecodeScaled(JpegDecoder *decoder, int scale, VisionFrame *frame)
+	{
+		ImageInfo info;
+		int width, height;
+		if(scale == 1 || !decoder->Start(frame->jpeg, frame->jpegSize, scale, width, height))
+			return false;
+		if(!imaqSetImageSize(frame->image->GetImaqImage(), width, height) ||
+				!imaqGetImageInfo(frame->image->GetImaqImage(), &info))
+			return false;
+		return decoder->Decode((unsigned char *)info.imageStart, info.pixelsPerLine);
+	}
+	
+	/**
+	 * Pack a processed frame into a VisionResult for the dashboard.
+	 */
+	static void SendResult(VisionFrame *frame, int trackId, double distance, int offset)
+	{
+		VisionResult result;
+		result.camera = frame->camera;
+		result.seq = frame->seq;
+		result.timestamp = (unsigned long)(frame->timestamp * 1e6);
+		result.distance = (long)(distance * 1000);
+		result.offset = offset;
+		result.threshold = frame->threshold;
+		result.alignment = g_targetAlign;
+		result.trackId = trackId;
+		result.imageWidth = frame->imageWidth;
+		result.imageHeight = frame->imageHeight;
+		result.rectCount = 0;
+		for(unsigned i = 0; i < frame->detections.size() && result.rectCount < VISION_MAX_RECTS; i++)
+		{
+			VisionRect &r = result.rects[result.rectCount++];
+			r.left = frame->detections[i].left;
+			r.top = frame->detections[i].top;
+			r.width = (int)frame->detections[i].width;
+			r.height = (int)frame->detections[i].height;
+		}
+		g_visionStream->SendResult(result);
+	}
+	
+	/**
+	 * Update a camera's tracker with its newest frame and pick its target.
+	 * With a held ID only the camera that owns the ID follows it.
+	 */
+	static void TrackCamera(VisionCamera *cam, int index, VisionFrame *frame)
+	{
+		trackPolicy policy = g_trackPolicy;
+		cam->tracker.Update(frame->detections, frame->timestamp);
+		if(policy == TRACK_ID && index == g_trackCamera && !cam->tracker.Select(TRACK_ID, g_trackId, cam->target))
+		{
+			// the held track is gone, go back to the default
+			g_trackPolicy = policy = TRACK_LOWEST;
+		}
+		if(policy == TRACK_ID && index != g_trackCamera)
+			policy = TRACK_LOWEST;
+		cam->locked = cam->tracker.Select(policy, g_trackId, cam->target) && cam->target.missed == 0;
+		cam->lockTime = frame->timestamp;
+	}
+	
+	/**
+	 * Fold every camera's current lock into one estimate.  Distance is
+	 * averaged weighted by each target's height squared, since taller
+	 * targets measure better.  The aim comes from the first camera in the
+	 * list with a confirmed lock, which is the one down the shooter.
+	 * Returns the aiming camera, or -1 if none has a confirmed lock.
+	 */
+	static int MergeTargets(double now, double &distance, double &bearing)
+	{
+		double sum = 0, weights = 0;
+		int aim = -1;
+		for(unsigned i = 0; i < g_cameras.size(); i++)
+		{
+			VisionCamera *cam = g_cameras[i];
+			if(!cam->locked || now - cam->lockTime > TARGET_STALE)
+				continue;
+			if(g_trackPolicy == TRACK_ID && (int)i != g_trackCamera)
+				continue;
+			double w = cam->target.height * cam->target.height;
+			sum += w * cam->target.distance;
+			weights += w;
+			if(aim < 0 && (cam->target.age > 3 || cam->target.posed))
 			{
-				if(stick3.GetTrigger())
-				{
-					lastPosition = tension.Get();
-					releaseSet = true;
-					releaseNotifier.StartSingle(0);
-				}
+				aim = i;
+				bearing = cam->yaw + cam->target.bearing;
 			}
-			
-			dsLCD->PrintfLine(DriverStationLCD::kUser_Line3, "encoder: %d", tension.Get());
-			dsLCD->PrintfLine(DriverStationLCD::kUser_Line4, "shooter: %d", shooter.Get());
-			dsLCD->PrintfLine(DriverStationLCD::kUser_Line5, "top: %d", top.Get());
-			dsLCD->PrintfLine(DriverStationLCD::kUser_Line6, "middle: %d", middle.Get());
-			dsLCD->UpdateLCD();
-			
-			Wait(0.005); // wait for a motor update time
 		}
-		autoAim.Stop();
-		targeting.Suspend();
-		blinkyLights.Suspend();
-		armToPositionNotifier.Stop();
-		releaseNotifier.Stop();
-		printf("OperatorControl: stop\n");
+		distance = weights > 0 ? sum / weights : 0;
+		return aim;
 	}
 	
 	/**
-	 * Task to handle targeting with the webcam.  Displays distance and target offset.
+	 * Vision targeting.  Tracks each camera's detections, merges them and
+	 * displays distance and target offset.
 	 */
 	static int Targeting(void)
 	{
-		printf("Targeting: start\n");
-		vector<Threshold> thresholds;
-		thresholds.push_back(Threshold(141, 253, 103, 253, 72, 255)); // LED flashlight
-		//thresholds.push_back(Threshold(126, 224, 210, 255, 0, 138));  // field
-		//thresholds.push_back(Threshold(0, 177, 165, 255, 0, 141));    // practice field
-		//thresholds.push_back(Threshold(0, 158, 123, 255, 0, 160)); // night
-		//thresholds.push_back(Threshold(107, 189, 150, 255, 68, 167)); // day
-		//thresholds.push_back(Threshold(78, 210, 184, 255, 0, 190)); // day close
-		ParticleFilterCriteria2 criteria[] = {
-			{IMAQ_MT_BOUNDING_RECT_WIDTH, 10, 400, false, false},
-			{IMAQ_MT_BOUNDING_RECT_HEIGHT, 10, 400, false, false}
-		};
-		double degsVert = 20;
-		double pi = 3.141592653589;
-		double rads = pi / (double)180;
-		double tapeHeight = 1.5;
-		ColorImage *image = NULL;
-		double fovVert, dv = 0;
-		double lastDist = 0;
-		double distCount = 0;
-		int centerMassX;
-		int centerWidth = 320 / 2;
-		int centerThresh = 20;
-		bool found = false;
-		ParticleAnalysisReport *target = NULL;
-		BinaryImage *thresholdImage = NULL;
-		BinaryImage *convexHullImage = NULL;
-		BinaryImage *bigObjectsImage = NULL;
-		BinaryImage *filteredImage = NULL;
-		vector<ParticleAnalysisReport> *reports = NULL;
-		ParticleAnalysisReport *r = NULL;
-		bool imageError = false;
-		unsigned i, j;
+		Log(LOG_TARGETING_START);
+		double dv = 0;
+		double bearing = 0;
+		double centerThresh = 0.06;   // radians, about 20 px at 320x240
+		int aim;
+		VisionFrame *frame = NULL;
 		
 		DriverStationLCD *dsLCD = DriverStationLCD::GetInstance();
 		dsLCD->PrintfLine(DriverStationLCD::kUser_Line1, "");
 		dsLCD->PrintfLine(DriverStationLCD::kUser_Line2, "");
-		dsLCD->PrintfLine(DriverStationLCD::kUser_Line3, "");
+		dsLCD->PrintfLine(DriverStationLCD::kUser_Line5, "");
 		dsLCD->UpdateLCD();
 		
 		DriverStation *ds = DriverStation::GetInstance();
 
 		while(true) {
-			if(!camera->IsFreshImage()) 
-			{
-				printf("Image is not fresh.\n");
-				Wait(1.0);
-				continue;
-			}
 			if(ds->GetDigitalIn(5))
 			{
 				dsLCD->PrintfLine(DriverStationLCD::kUser_Line1, "Targeting Disabled");
 				dsLCD->PrintfLine(DriverStationLCD::kUser_Line2, "");
-				dsLCD->PrintfLine(DriverStationLCD::kUser_Line3, "");
+				dsLCD->PrintfLine(DriverStationLCD::kUser_Line5, "");
 				dsLCD->UpdateLCD();
+				g_targetDistance = 0;
+				g_targetBearing = 0;
+				g_targetAlign = TARGET_NONE;
 				Wait(1.0);
 				continue;
 			}
 			
-			found = false;
-			image = new RGBImage();
-			camera->GetImage(image);
-			
-			if(image->GetWidth() == 0 || image->GetHeight() == 0)
+			frame = g_resultQueue->Get(sysClkRateGet());
+			if(!frame)
 			{
-				printf("Image width or height is 0.\n");
-				delete image;
-				Wait(1.0);
+				Log(LOG_NOT_FRESH);
+				g_targetDistance = 0;
+				g_targetBearing = 0;
 				continue;
 			}
-						
-			// loop through our threshold values
-			for(i = 0; i < thresholds.size() && !found; i++)
+			VisionCamera *cam = g_cameras[frame->camera];
+			
+			// never go back in time
+			if(cam->targeted && frame->seq <= cam->lastSeq)
 			{
-				thresholdImage = image->ThresholdRGB(thresholds.at(i));
-				if(!thresholdImage)
-				{
-					imageError = true;
-				}
-				if(!imageError)
-				{
-					convexHullImage = thresholdImage->ConvexHull(false);  // fill in partial and full rectangles
-					if(!convexHullImage)
-					{
-						imageError = true;
-					}
-				}
-				if(!imageError)
-				{
-					bigObjectsImage = convexHullImage->ParticleFilter(criteria, 2);  // find the rectangles
-					if(!bigObjectsImage)
-					{
-						imageError = true;
-					}
-				}
-				if(!imageError)
-				{
-					filteredImage = bigObjectsImage->RemoveSmallObjects(false, 2);  // remove small objects (noise)
-					if(!filteredImage)
-					{
-						imageError = true;
-					}
-				}
-				if(!imageError)
-				{
-					reports = filteredImage->GetOrderedParticleAnalysisReports();  // get the results
-				}
-				
-				// loop through the reports
-				for (j = 0; reports && j < reports->size(); j++)
-				{
-					r = &(reports->at(j));
-
-					// get the bottom-most basket
-					if(!target || target->center_mass_y < r->center_mass_y)
-					{
-						fovVert = (double)(tapeHeight * (double)r->imageHeight) / (double)r->boundingRect.height;
-						dv = (double)(fovVert / (double)2) / tan(degsVert * rads);
-						target = r;
-						centerMassX = target->center_mass_x;
-					}
-					found = true;
-				}
-				
-				if(reports && !reports->size())
-				{
-					printf("No particles found.\n");
-				}
-				else if(imageError)
-				{
-					printf("Image processing error.\n");
-				}
-				else
-				{
-					printf("Particles found.\n");
-				}
-				
-			    delete filteredImage;
-				delete convexHullImage;
-				delete bigObjectsImage;
-				delete thresholdImage;
-				delete reports;
-				filteredImage = NULL;
-				convexHullImage = NULL;
-				bigObjectsImage = NULL;
-				thresholdImage = NULL;
-				reports = NULL;
-				target = NULL;
-				imageError = false;
+				delete frame;
+				continue;
 			}
+			cam->targeted = true;
+			cam->lastSeq = frame->seq;
+			
+			// associate with the camera's last frame, then merge across cameras
+			TrackCamera(cam, frame->camera, frame);
+			aim = MergeTargets(frame->timestamp, dv, bearing);
 			
-			// determine how many times we've seen a reading
-			if(!distCount)
+			// write to the dashboard once the track has been seen a certain number of times,
+			// or straight away if the corners gave a pose
+			if(aim >= 0)
 			{
-				distCount++;
-			}
-			else
-			{	
-				if(lastDist == dv ||
-				   (lastDist < dv && dv - lastDist < 1) ||
-				   (lastDist > dv && lastDist - dv < 1))
+				VisionCamera *a = g_cameras[aim];
+				g_targetCamera = aim;
+				dsLCD->PrintfLine(DriverStationLCD::kUser_Line1, "target %s %d: %f", a->name, a->target.id, dv);
+				if(a->target.posed)
 				{
-					distCount++;
+					dsLCD->PrintfLine(DriverStationLCD::kUser_Line5, "brg %.1f view %.1f",
+							bearing * 180 / 3.141592653589, a->target.viewAngle * 180 / 3.141592653589);
 				}
 				else
 				{
-					distCount = 0;
-				}	
-			}
-			lastDist = dv;
-			
-			// write to the dashboard if we've seen the same value a certain number of times
-			if(distCount > 3)
-			{
-				dsLCD->PrintfLine(DriverStationLCD::kUser_Line1, "target: %f", dv);
-				if(centerMassX == centerWidth ||
-				   (centerMassX > centerWidth && centerMassX - centerWidth < centerThresh) ||
-				   (centerMassX < centerWidth && centerWidth - centerMassX < centerThresh))
+					dsLCD->PrintfLine(DriverStationLCD::kUser_Line5, "");
+				}
+				if(fabs(bearing) <= centerThresh)
 				{
-					dsLCD->PrintfLine(DriverStationLCD::kUser_Line2, "%s (%d px %s)", "CENTER",
-							centerMassX > centerWidth ? centerMassX - centerWidth : centerWidth - centerMassX,
-						    centerMassX > centerWidth ? "right" : "left");
+					dsLCD->PrintfLine(DriverStationLCD::kUser_Line2, "%s (%.1f deg %s)", "CENTER",
+							fabs(bearing) * 180 / 3.141592653589, bearing > 0 ? "right" : "left");
 					g_targetAlign = TARGET_CENTER;
 				}
-				else if((centerMassX > centerWidth && centerMassX - centerWidth > centerThresh))
+				else if(bearing > 0)
 				{
 					dsLCD->PrintfLine(DriverStationLCD::kUser_Line2, "align: %s", "RIGHT");
 					g_targetAlign = TARGET_RIGHT;
 				}
-				else if ((centerMassX < centerWidth && centerWidth - centerMassX > centerThresh))
+				else
 				{
 					dsLCD->PrintfLine(DriverStationLCD::kUser_Line2, "align: %s", "LEFT");
 					g_targetAlign = TARGET_LEFT;
@@ -656,18 +2457,23 @@ public:
 			{
 				dsLCD->PrintfLine(DriverStationLCD::kUser_Line1, "*** NO TARGET ***");
 				dsLCD->PrintfLine(DriverStationLCD::kUser_Line2, "");
-				dsLCD->PrintfLine(DriverStationLCD::kUser_Line3, "");
+				dsLCD->PrintfLine(DriverStationLCD::kUser_Line5, "");
 				g_targetAlign = TARGET_NONE;
 			}
 			dsLCD->UpdateLCD();
 			
-			g_targetDistance = dv;
-			dv = 0;
+			// one frame of an unconfirmed track is too noisy to plan a shot on
+			g_targetDistance = aim >= 0 ? dv : 0;
+			g_targetBearing = aim >= 0 ? bearing : 0;
+			SendResult(frame, cam->locked ? cam->target.id : 0, cam->locked ? cam->target.distance : 0,
+					cam->locked ? (int)cam->target.x - frame->imageWidth / 2 : 0);
 			
-			delete image;
-			Wait(0.2);
+			// a worker spends decode plus detect on each frame
+			if(cam->governor)
+				cam->governor->FrameProcessed(frame->decodeTime + frame->detectTime);
+			delete frame;
 		}
-		printf("Targeting: stop\n");
+		Log(LOG_TARGETING_STOP);
 		
 		return 0;
 	}
@@ -714,151 +2520,50 @@ public:
 		arm.Set(TENSION_BRAKE);
 	}
 	
-	void ArmToPositionFull(int p)
-	{
-		if(tension.Get() < p && shooter.Get())
-		{
-			while(tension.Get() < p && this->IsEnabled())
-			{
-				arm.Set(ARM_SPEED_FULL_LOAD);
-				Wait(0.005);
-			}
-		}
-		else if(tension.Get() > p)
-		{
-			while(tension.Get() > p && this->IsEnabled())
-			{
-				arm.Set(ARM_SPEED_FULL_UNLOAD);
-				Wait(0.005);
-
-			}
-		}
-		arm.Set(TENSION_BRAKE);
-	}
-	
-	Encoder* GetTension()
-	{
-		return &tension;
-	}
-	
-	Jaguar* GetArm()
-	{
-		return &arm;
-	}
-	
-	DigitalInput* GetShooter()
-	{
-		return &shooter;
-	}
-	
-	DigitalInput* GetTop()
-	{
-		return &top;
-	}
-	
-	DigitalInput* GetMiddle()
-	{
-		return &middle;
-	}
-	
-	Victor* GetBridgeArm()
-	{
-		return &bridgeArm;
-	}
-	
-	Relay* GetRelease()
-	{
-		return &release;
-	}
-	
-	DigitalInput* GetTrigger()
-	{
-		return &trigger;
-	}
-	
-	Victor* GetShooterLoader()
-	{
-		return &shooterLoader;
-	}
-	
-	Relay* GetLights()
-	{
-		return &lights;
-	}
-	
-	static void ArmToPositionNotifier(void* p)
+	/**
+	 * Fire and reload, returning once the release sequence is done.
+	 */
+	void Release()
 	{
-		Sparky *s = (Sparky *)p;
-		Encoder *t = s->GetTension();
-		Jaguar *a = s->GetArm();
-		DigitalInput *shoot = s->GetShooter();
+		Log(LOG_RELEASE_START);
+		TeleopLogic logic;
+		TeleopInputs in;
+		TeleopOutputs out;
+		Timer t;
+		t.Start();
+		ReadInputs(in, t);
+		logic.Reset(in.t);
+		logic.StartRelease();
+		while(logic.ReleaseActive())
 		{
-			Synchronized sync(armSem);
-			if(t->Get() < encPos && shoot->Get())
-			{
-				while(t->Get() < encPos)
-				{
-					a->Set(-armSpeed);
-					Wait(0.005);
-				}
-			}
-			else if(t->Get() > encPos)
-			{
-				while(t->Get() > encPos)
-				{
-					a->Set(armSpeed);
-					Wait(0.005);
-				}
-			}
-			a->Set(TENSION_BRAKE);
-			armSet = false;
+			ReadInputs(in, t);
+			logic.StepRelease(in, out);
+			WriteOutputs(out);
+			Wait(0.005);
 		}
+		Log(LOG_RELEASE_DONE);
 	}
 	
-	static void ReleaseNotifier(void* p)
+	/**
+	 * Write out what the other Tasks have logged, a batch at a time, and
+	 * the tele-op trace.
+	 */
+	static int Logging(void)
 	{
-		printf("ReleaseNotifier: start\n");
-		Sparky *s = (Sparky *)p;
-		Relay *r = s->GetRelease();
-		Victor *sl = s->GetShooterLoader(); 
-		DigitalInput *t = s->GetTrigger();
-		DigitalInput *top = s->GetTop();
-		Encoder *e = s->GetTension();
+		while(true)
 		{
-			Synchronized sync(releaseSem);
-			while(t->Get() && s->IsEnabled())
-			{
-				r->Set(Relay::kReverse);
-				Wait(0.005);
-			}
-			Wait(0.1);
-			r->Set(Relay::kOff);
-			Wait(0.3);
-			releaseSet = false;
-			intakeOff = true;
-			armSet = true;
-			s->ArmToPositionFull(0);
-			while(e->Get() > ARM_ZERO_THRESH && s->IsEnabled())
-			{
-				Wait(0.1);
-			}
-			while(top->Get() && s->IsEnabled())
+			g_trace->Flush();
+			if(g_log->Drain(stdout, LOG_BATCH) < LOG_BATCH)
 			{
-				sl->Set(INTAKE_LOAD);
-				Wait(0.005);
+				Wait(LOG_PERIOD);
 			}
-			Wait(1.0);
-			sl->Set(INTAKE_OFF);
-			s->ArmToPosition(125);
-			intakeOff = false;
-			armSet = false;
-			printf("ReleaseNotifier: done\n");
 		}
+		return 0;
 	}
 	
 	static int BlinkyLights(void)
 	{
-		printf("BlinkyLights: start\n");
+		Log(LOG_BLINKY_START);
 		while(true)
 		{
 			if(g_shooter->Get() && g_top->Get() && g_middle->Get())
@@ -892,40 +2597,43 @@ public:
 			//printf("Blinking!\n");
 			Wait(1.0);
 		}
-		printf("BlinkyLights: done\n");
+		Log(LOG_BLINKY_DONE);
 		return 0;
 	}
 	
+	/**
+	 * Turn onto the target, faster the further off it is, until targeting
+	 * calls it centered or loses it.
+	 */
 	static int AutoAim(void)
 	{
 		Synchronized sync(autoAimSem);
-		printf("AutoAim: start\n");
+		Log(LOG_AUTO_AIM_START);
 		
 		targetAlignment ta = g_targetAlign;
-		double d = g_targetDistance;
 		
-		while(ta != TARGET_CENTER)
+		while(ta != TARGET_CENTER && ta != TARGET_NONE)
 		{
+			double speed = fabs(g_targetBearing) * AUTO_AIM_GAIN;
+			if(speed < AUTO_AIM_MIN_SPEED)
+				speed = AUTO_AIM_MIN_SPEED;
+			if(speed > AUTO_AIM_SPEED)
+				speed = AUTO_AIM_SPEED;
 			if(ta == TARGET_RIGHT)
 			{
-				g_sparky->TankDrive(AUTO_AIM_SPEED, -AUTO_AIM_SPEED);
+				g_sparky->TankDrive(speed, -speed);
 			}
-			else if(ta == TARGET_LEFT)
-			{
-				g_sparky->TankDrive(-AUTO_AIM_SPEED, AUTO_AIM_SPEED);
-			}
-			else if(ta == TARGET_NONE)
+			else
 			{
-				break;
+				g_sparky->TankDrive(-speed, speed);
 			}
 			Wait(0.1);
 			ta = g_targetAlign;
-			d = g_targetDistance;
 		}
 
 		g_sparky->TankDrive(MOTOR_OFF, MOTOR_OFF);
 		g_autoAimSet = false;
-		printf("AutoAim: done\n");
+		Log(LOG_AUTO_AIM_DONE);
 		return 0;
 	}
 };
@@ -0,0 +1,697 @@
+/*
+ * $Id$
+ */
+
+#ifndef TELEOPLOGIC_H
+#define TELEOPLOGIC_H
+
+#include <stdio.h>
+#include "ByteOrder.h"
+#include "ShotPlanner.h"
+
+/*
+ * Tele-op decision logic for Sparky.  Everything here works on plain input
+ * and output structs and knows nothing about WPILib, so the robot runs it
+ * every loop and TraceReplay.cpp runs the very same code on a PC against a
+ * recorded trace.
+ */
+
+// constants
+static const double MOTOR_OFF = 0.0;
+static const double TENSION_BRAKE = -0.06;
+static const double ARM_SPEED_COARSE = 0.5;
+static const double ARM_SPEED_COARSE_LOAD = -0.5;
+static const double ARM_SPEED_COARSE_UNLOAD = 0.5;
+static const double ARM_SPEED_FINE_LOAD = -0.3;
+static const double ARM_SPEED_FINE_UNLOAD = 0.2;
+static const double ARM_SPEED_FULL_LOAD = -1.0;
+static const double ARM_SPEED_FULL_UNLOAD = 1.0;
+static const double ARM_ZERO_THRESH = 75;
+static const int ARM_RELOAD_POSITION = 125;
+static const int ARM_PRESET_NEAR = 115;
+static const int ARM_PRESET_FAR = 175;
+static const int ARM_PRESET_AUTONOMOUS = 190;
+static const double INTAKE_LOAD = 1.0;
+static const double INTAKE_UNLOAD = -1.0;
+static const double INTAKE_OFF = 0.0;
+static const double BRIDGE_ARM_DOWN = 0.9;
+static const double BRIDGE_ARM_UP = -0.9;
+static const double BRIDGE_ARM_OFF = 0.0;
+
+typedef enum {RELAY_OFF, RELAY_FORWARD, RELAY_REVERSE} relayCommand;
+
+/**
+ * Who drives this loop.  DRIVE_AUTO_AIM leaves the motors to the AutoAim task.
+ */
+typedef enum {DRIVE_OFF, DRIVE_ARCADE, DRIVE_TANK, DRIVE_AUTO_AIM} driveCommand;
+
+/**
+ * Everything the tele-op logic reads in one loop.  Buttons and DS digital
+ * inputs are bitmasks, bit n-1 for button or input n.
+ */
+struct TeleopInputs
+{
+	double t;              // seconds since tele-op start, whole microseconds
+	unsigned stick1, stick2, stick3;
+	unsigned dsIn;
+	bool top, middle, shooter, trigger, bridgeArmUp, bridgeArmDown;
+	int tension;
+	bool autoAimSet;
+	bool enabled;
+	double targetDistance;   // feet, 0 with no target locked
+
+	bool Stick1(int b) const { return (stick1 >> (b - 1)) & 1; }
+	bool Stick2(int b) const { return (stick2 >> (b - 1)) & 1; }
+	bool Stick3(int b) const { return (stick3 >> (b - 1)) & 1; }
+	bool DigitalIn(int n) const { return (dsIn >> (n - 1)) & 1; }
+};
+
+/**
+ * Everything the tele-op logic commands.  Motor values persist from loop to
+ * loop just like a speed controller holds its last setting.
+ */
+struct TeleopOutputs
+{
+	driveCommand drive;
+	double arm;
+	double floorPickup;
+	double shooterLoader;
+	double bridgeArm;
+	relayCommand release;
+	bool resetTension;
+	bool startAutoAim;
+	shotOutcome shot;        // the driver just graded a shot
+
+	TeleopOutputs():
+		drive(DRIVE_OFF),
+		arm(TENSION_BRAKE),
+		floorPickup(INTAKE_OFF),
+		shooterLoader(INTAKE_OFF),
+		bridgeArm(BRIDGE_ARM_OFF),
+		release(RELAY_OFF),
+		resetTension(false),
+		startAutoAim(false),
+		shot(SHOT_NONE)
+	{
+	}
+};
+
+/**
+ * Flags shared between the tele-op loop and the arm and release sequences.
+ */
+struct TeleopState
+{
+	bool armSet;       // a sequence owns the arm
+	bool releaseSet;   // the release sequence is waiting on the trigger
+	bool intakeOff;    // the release sequence owns the intake
+	bool armUp, armDown;
+	int lastPosition;
+	double armTimerStart;
+
+	TeleopState():
+		armSet(false),
+		releaseSet(false),
+		intakeOff(false),
+		armUp(false),
+		armDown(false),
+		lastPosition(0),
+		armTimerStart(0)
+	{
+	}
+};
+
+/**
+ * Drives the arm to a preset encoder position.
+ */
+class ArmPreset
+{
+	typedef enum {IDLE, START, LOAD, UNLOAD} armPresetState;
+	armPresetState state;
+	int position;
+	double speed;
+
+public:
+	ArmPreset(): state(IDLE), position(0), speed(0) {}
+
+	bool Active() const { return state != IDLE; }
+
+	void Start(int p, double s)
+	{
+		position = p;
+		speed = s;
+		state = START;
+	}
+
+	void Step(const TeleopInputs &in, TeleopOutputs &out, TeleopState &st)
+	{
+		if(state == START)
+		{
+			if(in.tension < position && in.shooter)
+				state = LOAD;
+			else if(in.tension > position)
+				state = UNLOAD;
+			else
+				state = IDLE;
+		}
+		if(state == LOAD && in.tension >= position)
+			state = IDLE;
+		if(state == UNLOAD && in.tension <= position)
+			state = IDLE;
+
+		if(state == LOAD)
+		{
+			out.arm = -speed;
+		}
+		else if(state == UNLOAD)
+		{
+			out.arm = speed;
+		}
+		else
+		{
+			out.arm = TENSION_BRAKE;
+			st.armSet = false;
+		}
+	}
+};
+
+/**
+ * Fires the shooter: hold the release while the trigger switch is closed,
+ * let the arm all the way out, feed the next ball and wind back up to the
+ * reload position.
+ */
+class ReleaseSequence
+{
+	typedef enum {
+		IDLE, HOLD, SETTLE, PAUSE, UNWIND_LOAD, UNWIND_UNLOAD, ZERO,
+		LOAD, LOADED, REWIND_LOAD, REWIND_UNLOAD
+	} releaseState;
+	releaseState state;
+	double deadline;
+	bool pending;   // fired again mid-sequence, run once more afterwards
+
+	// arm is all the way out (or given up on), move on to feeding the ball
+	void Unwound(const TeleopInputs &in, TeleopOutputs &out)
+	{
+		out.arm = TENSION_BRAKE;
+		state = ZERO;
+		deadline = in.t;
+	}
+
+	void Done(TeleopOutputs &out, TeleopState &st)
+	{
+		out.arm = TENSION_BRAKE;
+		st.intakeOff = false;
+		st.armSet = false;
+		state = pending ? HOLD : IDLE;
+		pending = false;
+	}
+
+public:
+	ReleaseSequence(): state(IDLE), deadline(0), pending(false) {}
+
+	bool Active() const { return state != IDLE; }
+
+	void Start()
+	{
+		if(Active())
+			pending = true;
+		else
+			state = HOLD;
+	}
+
+	void Step(const TeleopInputs &in, TeleopOutputs &out, TeleopState &st)
+	{
+		switch(state)
+		{
+		case IDLE:
+			break;
+		case HOLD:
+			if(in.trigger && in.enabled)
+			{
+				out.release = RELAY_REVERSE;
+				break;
+			}
+			state = SETTLE;
+			deadline = in.t + 0.1;
+			// fall through
+		case SETTLE:
+			if(in.t < deadline)
+				break;
+			out.release = RELAY_OFF;
+			state = PAUSE;
+			deadline = in.t + 0.3;
+			break;
+		case PAUSE:
+			if(in.t < deadline)
+				break;
+			st.releaseSet = false;
+			st.intakeOff = true;
+			st.armSet = true;
+			if(in.tension < 0 && in.shooter)
+				state = UNWIND_LOAD;
+			else if(in.tension > 0)
+				state = UNWIND_UNLOAD;
+			else
+				Unwound(in, out);
+			break;
+		case UNWIND_LOAD:
+			if(in.tension < 0 && in.enabled)
+				out.arm = ARM_SPEED_FULL_LOAD;
+			else
+				Unwound(in, out);
+			break;
+		case UNWIND_UNLOAD:
+			if(in.tension > 0 && in.enabled)
+				out.arm = ARM_SPEED_FULL_UNLOAD;
+			else
+				Unwound(in, out);
+			break;
+		case ZERO:
+			// polled every 0.1 s
+			if(in.t < deadline)
+				break;
+			if(in.tension > ARM_ZERO_THRESH && in.enabled)
+			{
+				deadline = in.t + 0.1;
+				break;
+			}
+			state = LOAD;
+			// fall through
+		case LOAD:
+			if(in.top && in.enabled)
+			{
+				out.shooterLoader = INTAKE_LOAD;
+				break;
+			}
+			state = LOADED;
+			deadline = in.t + 1.0;
+			break;
+		case LOADED:
+			if(in.t < deadline)
+				break;
+			out.shooterLoader = INTAKE_OFF;
+			if(in.tension < ARM_RELOAD_POSITION && in.shooter)
+				state = REWIND_LOAD;
+			else if(in.tension > ARM_RELOAD_POSITION)
+				state = REWIND_UNLOAD;
+			else
+				Done(out, st);
+			break;
+		case REWIND_LOAD:
+			if(in.tension < ARM_RELOAD_POSITION && in.enabled)
+			{
+				out.arm = ARM_SPEED_COARSE_LOAD;
+				out.drive = DRIVE_OFF;
+			}
+			else
+			{
+				Done(out, st);
+			}
+			break;
+		case REWIND_UNLOAD:
+			if(in.tension > ARM_RELOAD_POSITION && in.enabled)
+			{
+				out.arm = ARM_SPEED_COARSE_UNLOAD;
+				out.drive = DRIVE_OFF;
+			}
+			else
+			{
+				Done(out, st);
+			}
+			break;
+		}
+	}
+};
+
+/**
+ * One tele-op loop: drive selection, bridge arm, shooter arm presets,
+ * ball intake rules and the release trigger, followed by a step of any
+ * running arm or release sequence.  While auto aim turns the robot the
+ * arm winds to the planned tension so it can fire once centered.
+ */
+class TeleopLogic
+{
+	TeleopState st;
+	ArmPreset armPreset;
+	ReleaseSequence release;
+	ShotPlanner planner;
+
+public:
+	void Reset(double t)
+	{
+		st = TeleopState();
+		st.armTimerStart = t;
+		armPreset = ArmPreset();
+		release = ReleaseSequence();
+		planner.Reset();
+	}
+
+	ShotPlanner &Planner()
+	{
+		return planner;
+	}
+
+	bool ReleaseActive() const
+	{
+		return release.Active();
+	}
+
+	void Step(const TeleopInputs &in, TeleopOutputs &out)
+	{
+		out.resetTension = false;
+		out.startAutoAim = false;
+		out.shot = SHOT_NONE;
+		planner.Update(in.t, in.targetDistance > 0, in.targetDistance);
+
+		// drive
+		if(!in.autoAimSet)
+		{
+			if(in.Stick1(1) && !in.Stick2(1))
+			{
+				out.drive = DRIVE_ARCADE;
+			}
+			else if(in.Stick1(1) && in.Stick2(1))
+			{
+				out.drive = DRIVE_TANK;
+			}
+			else if(in.Stick1(8) && !in.DigitalIn(5))
+			{
+				out.drive = DRIVE_AUTO_AIM;
+				out.startAutoAim = true;
+			}
+			else
+			{
+				out.drive = DRIVE_OFF;
+			}
+		}
+		else
+		{
+			out.drive = DRIVE_AUTO_AIM;
+		}
+
+		// bridge arm
+		if(in.Stick1(6))
+		{
+			if(!in.bridgeArmDown)
+			{
+				st.armDown = true;
+			}
+			if(st.armUp && !in.bridgeArmUp)
+			{
+				st.armUp = false;
+			}
+			if(!st.armDown || in.DigitalIn(6))
+			{
+				out.bridgeArm = BRIDGE_ARM_UP;
+			}
+			else
+			{
+				out.bridgeArm = BRIDGE_ARM_OFF;
+			}
+		}
+		else if(in.Stick1(7))
+		{
+			if(!in.bridgeArmUp)
+			{
+				st.armUp = true;
+			}
+			if(st.armDown && !in.bridgeArmDown)
+			{
+				st.armDown = false;
+			}
+			if(!st.armUp || in.DigitalIn(6))
+			{
+				out.bridgeArm = BRIDGE_ARM_DOWN;
+			}
+			else
+			{
+				out.bridgeArm = BRIDGE_ARM_OFF;
+			}
+		}
+		else
+		{
+			out.bridgeArm = BRIDGE_ARM_OFF;
+		}
+
+		// shooter arm
+		if(!st.armSet)
+		{
+			// zero encoder
+			if(in.DigitalIn(4))
+			{
+				if(in.Stick3(8))
+				{
+					out.resetTension = true;
+				}
+			}
+
+			// coarse adjustment
+			if(in.Stick3(3))
+			{
+				if(in.tension > 0 || in.DigitalIn(4))
+				{
+					out.arm = ARM_SPEED_COARSE_UNLOAD;
+				}
+			}
+			else if(in.Stick3(2) && in.shooter)
+			{
+				out.arm = ARM_SPEED_COARSE_LOAD;
+			}
+			// fine adjustment
+			else if(in.Stick3(5) && in.shooter)
+			{
+				out.arm = ARM_SPEED_FINE_LOAD;
+			}
+			else if(in.Stick3(4))
+			{
+				if(in.tension > 0 || in.DigitalIn(4))
+				{
+					out.arm = ARM_SPEED_FINE_UNLOAD;
+				}
+			}
+			// move to preset, planned from the target distance when there is one
+			else if(in.Stick3(9))
+			{
+				st.armSet = true;
+				armPreset.Start(planner.HasTarget() ? planner.Plan() : ARM_PRESET_NEAR, ARM_SPEED_COARSE);
+			}
+			else if(in.Stick3(8))
+			{
+				st.armSet = true;
+				armPreset.Start(0, ARM_SPEED_FULL_UNLOAD);
+			}
+			else if(in.Stick3(10))
+			{
+				st.armSet = true;
+				armPreset.Start(ARM_PRESET_FAR, ARM_SPEED_COARSE);
+			}
+			else if(in.Stick3(11))
+			{
+				st.armSet = true;
+				armPreset.Start(st.lastPosition, ARM_SPEED_COARSE);
+			}
+			else
+			{
+				out.arm = TENSION_BRAKE; // brake spool
+			}
+		}
+
+		// make sure that ball isn't settling in the arm
+		if(in.shooter)
+		{
+			st.armTimerStart = in.t;
+		}
+
+		// ball loading
+		if(!st.intakeOff)
+		{
+			if(in.Stick3(6))
+			{
+				if(in.shooter && in.top && in.middle)
+				{
+					out.floorPickup = INTAKE_OFF;
+				}
+				else if(in.top && in.middle && in.tension > ARM_ZERO_THRESH)
+				{
+					out.floorPickup = INTAKE_OFF;
+				}
+				else
+				{
+					out.floorPickup = INTAKE_LOAD;
+				}
+				if(!in.shooter && in.tension < ARM_ZERO_THRESH && in.t - st.armTimerStart > 1.0)
+				{
+					out.shooterLoader = INTAKE_LOAD;
+				}
+				else if(!in.top && in.shooter)
+				{
+					out.shooterLoader = INTAKE_LOAD;
+				}
+				else if(!in.top)
+				{
+					out.shooterLoader = INTAKE_LOAD;
+				}
+				else
+				{
+					out.shooterLoader = INTAKE_OFF;
+				}
+			}
+			else if(in.Stick3(7))
+			{
+				out.floorPickup = INTAKE_UNLOAD;
+				out.shooterLoader = INTAKE_UNLOAD;
+			}
+			else
+			{
+				out.floorPickup = INTAKE_OFF;
+				out.shooterLoader = INTAKE_OFF;
+			}
+		}
+
+		// release
+		if(!st.releaseSet)
+		{
+			if(in.Stick3(1))
+			{
+				st.lastPosition = in.tension;
+				st.releaseSet = true;
+				release.Start();
+				planner.Fired(in.tension);
+			}
+		}
+
+		// grade the last shot: 2 short, 3 long, 4 made
+		if(in.Stick2(2) || in.Stick2(3) || in.Stick2(4))
+		{
+			shotOutcome outcome = in.Stick2(2) ? SHOT_SHORT : in.Stick2(3) ? SHOT_LONG : SHOT_MADE;
+			if(planner.Judge(outcome))
+				out.shot = outcome;
+		}
+
+		// pre-wind while aiming
+		if(out.drive == DRIVE_AUTO_AIM && planner.HasTarget() && !st.armSet && !release.Active())
+		{
+			int plan = planner.Plan();
+			if(in.tension < plan - SHOT_DEADBAND || in.tension > plan + SHOT_DEADBAND)
+			{
+				st.armSet = true;
+				armPreset.Start(plan, ARM_SPEED_COARSE);
+			}
+		}
+
+		if(armPreset.Active())
+			armPreset.Step(in, out, st);
+		if(release.Active())
+			release.Step(in, out, st);
+	}
+
+	/**
+	 * Run just the release sequence, as autonomous does.
+	 */
+	void StartRelease()
+	{
+		release.Start();
+	}
+
+	void StepRelease(const TeleopInputs &in, TeleopOutputs &out)
+	{
+		release.Step(in, out, st);
+	}
+};
+
+/**
+ * One loop of a recorded trace: what the logic saw and what it commanded.
+ * Stored as fixed-size big-endian records so a trace taken on the robot
+ * reads back the same on a PC.
+ */
+struct TraceRecord
+{
+	TeleopInputs in;
+	TeleopOutputs out;
+
+	static const int SIZE = 40;
+
+	// motor values and the target distance are recorded in thousandths
+	static long Milli(double v)
+	{
+		return (long)(v * 1000 + (v < 0 ? -0.5 : 0.5));
+	}
+
+	void Pack(unsigned char *buf) const
+	{
+		unsigned char *p = buf;
+		unsigned long sensors =
+			(in.top << 0) | (in.middle << 1) | (in.shooter << 2) | (in.trigger << 3) |
+			(in.bridgeArmUp << 4) | (in.bridgeArmDown << 5) | (in.autoAimSet << 6) | (in.enabled << 7);
+		unsigned long flags =
+			(out.drive << 0) | (out.release << 4) | (out.resetTension << 8) | (out.startAutoAim << 9) |
+			(out.shot << 12);
+		Put32(p, (unsigned long)(in.t * 1e6 + 0.5));
+		Put32(p, (in.stick1 & 0xffff) | (in.stick2 << 16));
+		Put32(p, (in.stick3 & 0xffff) | ((in.dsIn & 0xff) << 16) | (sensors << 24));
+		Put32(p, (unsigned long)in.tension);
+		Put32(p, flags);
+		Put32(p, (unsigned long)Milli(out.arm));
+		Put32(p, (unsigned long)Milli(out.floorPickup));
+		Put32(p, (unsigned long)Milli(out.shooterLoader));
+		Put32(p, (unsigned long)Milli(out.bridgeArm));
+		Put32(p, (unsigned long)Milli(in.targetDistance));
+	}
+
+	bool Write(FILE *f) const
+	{
+		unsigned char buf[SIZE];
+		Pack(buf);
+		return fwrite(buf, SIZE, 1, f) == 1;
+	}
+
+	bool Read(FILE *f)
+	{
+		unsigned char buf[SIZE];
+		const unsigned char *p = buf;
+		unsigned long v;
+		if(fread(buf, SIZE, 1, f) != 1)
+			return false;
+		in.t = Get32(p) / 1e6;
+		v = Get32(p);
+		in.stick1 = v & 0xffff;
+		in.stick2 = (v >> 16) & 0xffff;
+		v = Get32(p);
+		in.stick3 = v & 0xffff;
+		in.dsIn = (v >> 16) & 0xff;
+		in.top = (v >> 24) & 1;
+		in.middle = (v >> 25) & 1;
+		in.shooter = (v >> 26) & 1;
+		in.trigger = (v >> 27) & 1;
+		in.bridgeArmUp = (v >> 28) & 1;
+		in.bridgeArmDown = (v >> 29) & 1;
+		in.autoAimSet = (v >> 30) & 1;
+		in.enabled = (v >> 31) & 1;
+		in.tension = (int)Signed32(Get32(p));
+		v = Get32(p);
+		out.drive = (driveCommand)(v & 0xf);
+		out.release = (relayCommand)((v >> 4) & 0xf);
+		out.resetTension = (v >> 8) & 1;
+		out.startAutoAim = (v >> 9) & 1;
+		out.shot = (shotOutcome)((v >> 12) & 0xf);
+		out.arm = Signed32(Get32(p)) / 1000.0;
+		out.floorPickup = Signed32(Get32(p)) / 1000.0;
+		out.shooterLoader = Signed32(Get32(p)) / 1000.0;
+		out.bridgeArm = Signed32(Get32(p)) / 1000.0;
+		in.targetDistance = Signed32(Get32(p)) / 1000.0;
+		return true;
+	}
+
+	/**
+	 * Compare commands the way they are recorded.
+	 */
+	static bool SameOutputs(const TeleopOutputs &a, const TeleopOutputs &b)
+	{
+		return a.drive == b.drive && a.release == b.release &&
+			a.resetTension == b.resetTension && a.startAutoAim == b.startAutoAim && a.shot == b.shot &&
+			Milli(a.arm) == Milli(b.arm) && Milli(a.floorPickup) == Milli(b.floorPickup) &&
+			Milli(a.shooterLoader) == Milli(b.shooterLoader) && Milli(a.bridgeArm) == Milli(b.bridgeArm);
+	}
+};
+
+#endif
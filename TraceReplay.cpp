@@ -0,0 +1,147 @@
+/*
+ * $Id$
+ */
+
+/*
+ * Replays a tele-op trace recorded on the robot through TeleopLogic and
+ * diffs the commands against a golden run.  Host tool only; build on a PC
+ * with
+ *
+ *     g++ -O2 -o TraceReplay TraceReplay.cpp
+ *
+ * Usage:
+ *     TraceReplay trace                  check against the commands in the trace
+ *     TraceReplay trace golden           check against another run
+ *     TraceReplay -w golden trace        write this run's commands as the golden run
+ *
+ * -s table starts the shot planner from a table the robot saved alongside
+ * the trace rather than from the built-in calibration.
+ *
+ * Exits 1 on the first mismatched run, 2 on bad arguments or files.
+ */
+
+#ifndef __vxworks
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "TeleopLogic.h"
+
+using namespace std;
+
+static const int MAX_REPORTED = 20;
+
+static bool ReadTrace(const char *path, vector<TraceRecord> &records)
+{
+	FILE *f = fopen(path, "rb");
+	TraceRecord r;
+	if(!f)
+	{
+		fprintf(stderr, "TraceReplay: can't open %s\n", path);
+		return false;
+	}
+	while(r.Read(f))
+		records.push_back(r);
+	fclose(f);
+	return true;
+}
+
+static void PrintOutputs(const char *label, const TeleopOutputs &o)
+{
+	printf("  %-8s drive %d arm %.3f floor %.3f loader %.3f bridge %.3f release %d reset %d autoAim %d shot %d\n",
+			label, o.drive, o.arm, o.floorPickup, o.shooterLoader, o.bridgeArm,
+			o.release, o.resetTension, o.startAutoAim, o.shot);
+}
+
+int main(int argc, char **argv)
+{
+	const char *writePath = NULL;
+	const char *tracePath = NULL;
+	const char *goldenPath = NULL;
+	const char *tablePath = NULL;
+	vector<TraceRecord> trace, golden;
+	TeleopLogic logic;
+	TeleopOutputs out;
+	FILE *w = NULL;
+	int mismatches = 0;
+	unsigned i;
+	clock_t start;
+	double elapsed, duration;
+
+	while(argc > 2 && (!strcmp(argv[1], "-w") || !strcmp(argv[1], "-s")))
+	{
+		if(!strcmp(argv[1], "-w"))
+			writePath = argv[2];
+		else
+			tablePath = argv[2];
+		argv += 2;
+		argc -= 2;
+	}
+	if(argc < 2 || argc > 3)
+	{
+		fprintf(stderr, "usage: TraceReplay [-s table] [-w golden] trace [golden]\n");
+		return 2;
+	}
+	if(tablePath && !logic.Planner().Table().Load(tablePath))
+	{
+		fprintf(stderr, "TraceReplay: can't read shot table %s\n", tablePath);
+		return 2;
+	}
+	tracePath = argv[1];
+	goldenPath = argc == 3 ? argv[2] : argv[1];
+
+	if(!ReadTrace(tracePath, trace))
+		return 2;
+	if(goldenPath == tracePath)
+		golden = trace;
+	else if(!ReadTrace(goldenPath, golden))
+		return 2;
+	if(!trace.size())
+	{
+		fprintf(stderr, "TraceReplay: %s is empty\n", tracePath);
+		return 2;
+	}
+	if(writePath && !(w = fopen(writePath, "wb")))
+	{
+		fprintf(stderr, "TraceReplay: can't create %s\n", writePath);
+		return 2;
+	}
+
+	start = clock();
+	logic.Reset(trace[0].in.t);
+	for(i = 0; i < trace.size(); i++)
+	{
+		logic.Step(trace[i].in, out);
+		if(w)
+		{
+			TraceRecord r;
+			r.in = trace[i].in;
+			r.out = out;
+			r.Write(w);
+		}
+		else if(i >= golden.size() || !TraceRecord::SameOutputs(out, golden[i].out))
+		{
+			if(mismatches++ < MAX_REPORTED)
+			{
+				printf("loop %u at %.6f s:\n", i, trace[i].in.t);
+				if(i < golden.size())
+					PrintOutputs("golden", golden[i].out);
+				PrintOutputs("replay", out);
+			}
+		}
+	}
+	elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	duration = trace[trace.size() - 1].in.t - trace[0].in.t;
+	if(w)
+		fclose(w);
+
+	printf("TraceReplay: %u loops, %.1f s of tele-op in %.3f s", (unsigned)trace.size(), duration, elapsed);
+	if(elapsed > 0)
+		printf(" (%.0fx real time)", duration / elapsed);
+	printf(", %d mismatched\n", mismatches);
+
+	return mismatches ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,349 @@
+/*
+ * $Id$
+ */
+
+/*
+ * Runs several file-backed cameras through the vision worker scheduling
+ * on a PC and reports what each camera got out of the pool.  Each frame
+ * is decoded by JpegDecoder at 1/scale and goes through the robot's run
+ * length detect steps, threshold, convex hull, size filter, small object
+ * removal and particle reports, so running at -s 1 and -s 2 compares the
+ * reduced size decode with a full size one.  Only the pose estimate is
+ * left out, since it lives with the robot code.  NI
+ * Vision isn't available off the robot, so files JpegDecoder turns down
+ * cost a stand-in pass over their full size instead.  Host tool only;
+ * build on a PC with
+ *
+ *     g++ -O2 -o VisionBench VisionBench.cpp -lpthread
+ *
+ * Usage:
+ *     VisionBench [-w workers] [-t seconds] [-s scale] camera...
+ *
+ * where each camera is pattern,fps,share,latency[,passes]: JPEG files
+ * pattern % 0, pattern % 1, ... played back at fps, its share of the
+ * workers, its latency target in seconds and how many stand-in passes
+ * each frame costs (default 1).  For example
+ *
+ *     VisionBench -w 2 'front/%04d.jpg,10,2,0.15' 'side/%04d.jpg,5,1,0.4,2'
+ */
+
+#ifndef __vxworks
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+#include "VisionSource.h"
+#include "VisionScheduler.h"
+#include "JpegDecoder.h"
+#include "RunMask.h"
+
+using namespace std;
+
+static const int MAX_WORKERS = 16;
+
+// the robot's LED flashlight threshold, red, green, blue, and rectangle size
+static const unsigned THRESHOLD_LOW[3] = {141, 103, 72};
+static const unsigned THRESHOLD_SPAN[3] = {112, 150, 183};
+static const int MIN_RECT = 10;
+static const int MAX_RECT = 400;
+
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+struct BenchFrame
+{
+	int camera;
+	double captured;
+	char *jpeg;
+	int jpegSize;
+	int jpegBufferSize;
+
+	BenchFrame(): camera(0), captured(0), jpeg(NULL), jpegSize(0), jpegBufferSize(0) {}
+	~BenchFrame() { delete [] jpeg; }
+};
+
+struct BenchCamera
+{
+	const char *pattern;
+	double fps, share, latency;
+	int passes;
+	FileVisionSource *source;
+};
+
+// shared between the capture thread and the workers
+static FrameScheduler<BenchFrame> g_scheduler;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_ready = PTHREAD_COND_INITIALIZER;
+static vector<BenchCamera> g_cameras;
+static volatile bool g_running = true;
+static volatile unsigned g_sink;
+static int g_scale = 1;
+
+/**
+ * Per worker images, kept to save allocating every frame.
+ */
+struct BenchImages
+{
+	vector<unsigned char> pixels;
+	RunMask mask, hull, big, filtered;
+	vector<MaskParticle> reports;
+};
+
+static bool InRange(const unsigned char *p)
+{
+	return (unsigned)(p[2] - THRESHOLD_LOW[0]) <= THRESHOLD_SPAN[0] &&
+		(unsigned)(p[1] - THRESHOLD_LOW[1]) <= THRESHOLD_SPAN[1] &&
+		(unsigned)(p[0] - THRESHOLD_LOW[2]) <= THRESHOLD_SPAN[2];
+}
+
+/**
+ * The robot's threshold: runs of in range pixels, skipping quads that
+ * don't change whether we are in a run.
+ */
+static void Threshold(const vector<unsigned char> &pixels, int width, int height, RunMask &dst)
+{
+	dst.Reset(width, height);
+	for(int y = 0; y < height; y++)
+	{
+		const unsigned char *p = &pixels[y * width * 4];
+		int start = -1;
+		int x = 0;
+		for(; x + 4 <= width; x += 4)
+		{
+			int quad = InRange(p + x * 4) | InRange(p + x * 4 + 4) << 1 |
+					InRange(p + x * 4 + 8) << 2 | InRange(p + x * 4 + 12) << 3;
+			if(quad == (start < 0 ? 0 : 15))
+				continue;
+			for(int i = 0; i < 4; i++)
+			{
+				if((quad >> i & 1) == (start < 0))
+				{
+					if(start < 0)
+					{
+						start = x + i;
+					}
+					else
+					{
+						dst.Add(start, x + i);
+						start = -1;
+					}
+				}
+			}
+		}
+		for(; x < width; x++)
+		{
+			if(InRange(p + x * 4) == (start < 0))
+			{
+				if(start < 0)
+				{
+					start = x;
+				}
+				else
+				{
+					dst.Add(start, x);
+					start = -1;
+				}
+			}
+		}
+		if(start >= 0)
+			dst.Add(start, width);
+		dst.EndRow();
+	}
+}
+
+/**
+ * Decode at 1/g_scale into blue, green, red, alpha pixels, then detect as
+ * the robot does.  A file JpegDecoder turns down is spread over an image
+ * of its full size instead.
+ */
+static void Work(JpegDecoder &decoder, const BenchFrame *frame, int passes, BenchImages &images)
+{
+	vector<unsigned char> &pixels = images.pixels;
+	int width = 320, height = 240;
+	unsigned found = 0;
+	for(int pass = 0; pass < passes; pass++)
+	{
+		if(decoder.Start(frame->jpeg, frame->jpegSize, g_scale, width, height))
+		{
+			pixels.resize(width * height * 4);
+			decoder.Decode(&pixels[0], width);
+		}
+		else
+		{
+			JpegSize(frame->jpeg, frame->jpegSize, width, height);
+			pixels.resize(width * height * 4);
+			for(int i = 0, j = 0; i < (int)pixels.size(); i++)
+			{
+				pixels[i] = frame->jpeg[j] + pass;
+				if(++j == frame->jpegSize)
+					j = 0;
+			}
+		}
+		Threshold(pixels, width, height, images.mask);
+		images.mask.ConvexHull(images.hull, false);
+		images.hull.ParticleFilter(images.big, MIN_RECT, MAX_RECT, MIN_RECT, MAX_RECT, false);
+		images.big.RemoveSmallObjects(images.filtered, false, 2);
+		images.filtered.GetParticles(images.reports, false);
+		found += images.reports.size();
+	}
+	g_sink += found;
+}
+
+static void *Worker(void *)
+{
+	BenchImages *images = new BenchImages();
+	JpegDecoder *decoder = new JpegDecoder();
+	while(true)
+	{
+		BenchFrame *frame = NULL;
+		int camera;
+		pthread_mutex_lock(&g_lock);
+		while(g_running && !(frame = g_scheduler.Next(camera)))
+			pthread_cond_wait(&g_ready, &g_lock);
+		pthread_mutex_unlock(&g_lock);
+		if(!frame)
+		{
+			delete decoder;
+			delete images;
+			return NULL;
+		}
+
+		double start = Now();
+		Work(*decoder, frame, g_cameras[camera].passes, *images);
+		double end = Now();
+
+		pthread_mutex_lock(&g_lock);
+		g_scheduler.Done(camera, end - start, end - frame->captured);
+		pthread_mutex_unlock(&g_lock);
+		delete frame;
+	}
+}
+
+static bool ParseCamera(char *spec, BenchCamera &c)
+{
+	char *field[5] = {NULL};
+	int n = 0;
+	for(char *p = strtok(spec, ","); p && n < 5; p = strtok(NULL, ","))
+		field[n++] = p;
+	if(n < 4)
+		return false;
+	c.pattern = field[0];
+	c.fps = atof(field[1]);
+	c.share = atof(field[2]);
+	c.latency = atof(field[3]);
+	c.passes = n > 4 ? atoi(field[4]) : 1;
+	return c.fps > 0 && c.share > 0 && c.latency > 0 && c.passes > 0;
+}
+
+int main(int argc, char **argv)
+{
+	int workers = 2;
+	double seconds = 10;
+	pthread_t threads[MAX_WORKERS];
+	double start, end;
+	int c, i;
+
+	while((c = getopt(argc, argv, "w:t:s:")) != -1)
+	{
+		switch(c)
+		{
+		case 'w':
+			workers = atoi(optarg);
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 's':
+			g_scale = atoi(optarg);
+			break;
+		default:
+			argc = 0;
+			break;
+		}
+	}
+	if(argc <= optind || workers < 1 || workers > MAX_WORKERS ||
+			(g_scale != 1 && g_scale != 2 && g_scale != 4 && g_scale != 8))
+	{
+		fprintf(stderr, "usage: VisionBench [-w workers] [-t seconds] [-s scale] pattern,fps,share,latency[,passes]...\n");
+		return 2;
+	}
+	for(i = optind; i < argc; i++)
+	{
+		BenchCamera cam;
+		if(!ParseCamera(argv[i], cam))
+		{
+			fprintf(stderr, "VisionBench: bad camera %s\n", argv[i]);
+			return 2;
+		}
+		cam.source = new FileVisionSource(cam.pattern, cam.fps, Now);
+		if(!cam.source->Frames())
+		{
+			fprintf(stderr, "VisionBench: no frames for %s\n", cam.pattern);
+			return 2;
+		}
+		g_cameras.push_back(cam);
+		g_scheduler.AddCamera(cam.share, cam.latency);
+	}
+
+	for(i = 0; i < workers; i++)
+		pthread_create(&threads[i], NULL, Worker, NULL);
+
+	// capture, as the robot's VisionCapture task does
+	start = Now();
+	while(Now() - start < seconds)
+	{
+		bool any = false;
+		for(i = 0; i < (int)g_cameras.size(); i++)
+		{
+			if(!g_cameras[i].source->IsFreshImage())
+				continue;
+			BenchFrame *frame = new BenchFrame();
+			frame->camera = i;
+			frame->captured = Now();
+			g_cameras[i].source->CopyJPEG(&frame->jpeg, frame->jpegSize, frame->jpegBufferSize);
+			pthread_mutex_lock(&g_lock);
+			BenchFrame *old = g_scheduler.Offer(i, frame, frame->captured);
+			pthread_cond_signal(&g_ready);
+			pthread_mutex_unlock(&g_lock);
+			delete old;
+			any = true;
+		}
+		if(!any)
+			usleep(1000);
+	}
+	end = Now();
+
+	pthread_mutex_lock(&g_lock);
+	g_running = false;
+	pthread_cond_broadcast(&g_ready);
+	pthread_mutex_unlock(&g_lock);
+	for(i = 0; i < workers; i++)
+		pthread_join(threads[i], NULL);
+
+	printf("VisionBench: %d workers, %.1f s, decoding at 1/%d\n", workers, end - start, g_scale);
+	printf("camera  offered  served  dropped   fps  busy/frame  share  latency avg  worst  over target\n");
+	double busy = 0;
+	for(i = 0; i < (int)g_cameras.size(); i++)
+		busy += g_scheduler.Stats(i).busy;
+	for(i = 0; i < (int)g_cameras.size(); i++)
+	{
+		const CameraStats &st = g_scheduler.Stats(i);
+		long served = st.served ? st.served : 1;
+		printf("%6d  %7ld  %6ld  %7ld  %4.1f  %10.4f  %4.0f%%  %11.4f  %.4f  %ld of %ld over %.3f\n",
+				i, st.offered, st.served, st.dropped, st.served / (end - start), st.busy / served,
+				busy > 0 ? 100 * st.busy / busy : 0, st.latencySum / served, st.worstLatency,
+				st.late, st.served, g_scheduler.LatencyTarget(i));
+	}
+
+	return 0;
+}
+
+#endif
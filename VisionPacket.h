@@ -0,0 +1,154 @@
+/*
+ * $Id$
+ */
+
+#ifndef VISIONPACKET_H
+#define VISIONPACKET_H
+
+#include "ByteOrder.h"
+
+/*
+ * Wire format of the vision stream sent to the dashboard over UDP.
+ */
+
+static const unsigned long VISION_MAGIC = 0x53504b59;  // "SPKY"
+static const int VISION_VERSION = 2;
+static const int VISION_PORT = 1180;
+static const int VISION_MAX_RECTS = 4;
+static const int VISION_CHUNK_PAYLOAD = 1024;
+
+typedef enum {VISION_RESULT = 1, VISION_FRAME = 2} visionPacketType;
+
+struct VisionRect
+{
+	int left, top, width, height;
+};
+
+/**
+ * Outcome of one processed frame.  Distance is in thousandths of a foot
+ * and offset is the selected target's pixels right of image center.
+ */
+struct VisionResult
+{
+	int camera;                // which of the robot's cameras
+	unsigned long seq;
+	unsigned long timestamp;   // microseconds, robot clock
+	long distance;
+	int offset;
+	int threshold;             // index of the threshold that matched, -1 for none
+	int alignment;
+	int trackId;               // 0 when nothing is locked
+	int imageWidth, imageHeight;
+	int rectCount;
+	VisionRect rects[VISION_MAX_RECTS];
+
+	static const int SIZE = 32 + 8 * VISION_MAX_RECTS;
+
+	int Pack(unsigned char *buf) const
+	{
+		unsigned char *p = buf;
+		Put32(p, VISION_MAGIC);
+		Put8(p, VISION_RESULT);
+		Put8(p, VISION_VERSION);
+		Put8(p, (unsigned long)camera);
+		Put8(p, 0);
+		Put32(p, seq);
+		Put32(p, timestamp);
+		Put32(p, (unsigned long)distance);
+		Put16(p, (unsigned long)offset);
+		Put8(p, (unsigned long)threshold);
+		Put8(p, (unsigned long)alignment);
+		Put16(p, (unsigned long)trackId);
+		Put16(p, (unsigned long)imageWidth);
+		Put16(p, (unsigned long)imageHeight);
+		Put8(p, (unsigned long)rectCount);
+		Put8(p, 0);
+		for(int i = 0; i < VISION_MAX_RECTS; i++)
+		{
+			bool used = i < rectCount;
+			Put16(p, used ? rects[i].left : 0);
+			Put16(p, used ? rects[i].top : 0);
+			Put16(p, used ? rects[i].width : 0);
+			Put16(p, used ? rects[i].height : 0);
+		}
+		return p - buf;
+	}
+
+	bool Unpack(const unsigned char *buf, int len)
+	{
+		const unsigned char *p = buf;
+		if(len != SIZE || Get32(p) != VISION_MAGIC || Get8(p) != VISION_RESULT || Get8(p) != VISION_VERSION)
+			return false;
+		camera = Get8(p);
+		Get8(p);
+		seq = Get32(p);
+		timestamp = Get32(p);
+		distance = Signed32(Get32(p));
+		offset = Signed16(Get16(p));
+		threshold = Signed8(Get8(p));
+		alignment = Get8(p);
+		trackId = Get16(p);
+		imageWidth = Get16(p);
+		imageHeight = Get16(p);
+		rectCount = Get8(p);
+		Get8(p);
+		if(rectCount > VISION_MAX_RECTS)
+			return false;
+		for(int i = 0; i < VISION_MAX_RECTS; i++)
+		{
+			rects[i].left = Signed16(Get16(p));
+			rects[i].top = Signed16(Get16(p));
+			rects[i].width = Get16(p);
+			rects[i].height = Get16(p);
+		}
+		return true;
+	}
+};
+
+/**
+ * Header of one piece of an 8-bit grayscale debug frame.  Chunk i carries
+ * bytes [i * VISION_CHUNK_PAYLOAD, ...) of the width * height pixels.
+ * Frames are numbered per camera, so camera and seq together name one.
+ */
+struct VisionFrameChunk
+{
+	int camera;
+	unsigned long seq;
+	int chunk, chunks;
+	int width, height;
+
+	static const int HEADER_SIZE = 20;
+
+	int PackHeader(unsigned char *buf) const
+	{
+		unsigned char *p = buf;
+		Put32(p, VISION_MAGIC);
+		Put8(p, VISION_FRAME);
+		Put8(p, VISION_VERSION);
+		Put8(p, (unsigned long)chunk);
+		Put8(p, (unsigned long)chunks);
+		Put32(p, seq);
+		Put16(p, (unsigned long)width);
+		Put16(p, (unsigned long)height);
+		Put8(p, (unsigned long)camera);
+		Put8(p, 0);
+		Put16(p, 0);
+		return p - buf;
+	}
+
+	bool UnpackHeader(const unsigned char *buf, int len)
+	{
+		const unsigned char *p = buf;
+		if(len < HEADER_SIZE || Get32(p) != VISION_MAGIC || Get8(p) != VISION_FRAME || Get8(p) != VISION_VERSION)
+			return false;
+		chunk = Get8(p);
+		chunks = Get8(p);
+		seq = Get32(p);
+		width = Get16(p);
+		height = Get16(p);
+		camera = Get8(p);
+		return chunk < chunks;
+	}
+};
+
+#endif
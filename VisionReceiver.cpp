@@ -0,0 +1,172 @@
+/*
+ * $Id$
+ */
+
+/*
+ * Stand-in for the dashboard end of the vision stream.  Listens for the
+ * robot's UDP packets, prints one line per result and writes the debug
+ * thumbnails out as PGM files.  Host tool only; build on a PC with
+ *
+ *     g++ -O2 -o VisionReceiver VisionReceiver.cpp
+ *
+ * Usage:
+ *     VisionReceiver [-p port] [-f dir] [-n count]
+ *
+ * -f saves thumbnails to dir/frame-<camera>-<seq>.pgm, -n stops after count
+ * results.
+ */
+
+#ifndef __vxworks
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <vector>
+#include "VisionPacket.h"
+
+using namespace std;
+
+static const char *ALIGNMENT[] = {"LEFT", "RIGHT", "CENTER", "NONE"};
+
+/**
+ * Reassembles one camera's debug frames, one at a time; a chunk from a
+ * newer frame abandons whatever was left of the previous one.
+ */
+struct FrameAssembler
+{
+	unsigned long seq;
+	int width, height, received, chunks;
+	vector<unsigned char> pixels;
+	vector<bool> have;
+
+	FrameAssembler(): seq(0), width(0), height(0), received(0), chunks(0) {}
+
+	// returns true once every chunk of the current frame is in
+	bool Add(const VisionFrameChunk &h, const unsigned char *payload, int len)
+	{
+		if(h.seq != seq || h.width != width || h.height != height || h.chunks != chunks)
+		{
+			seq = h.seq;
+			width = h.width;
+			height = h.height;
+			chunks = h.chunks;
+			received = 0;
+			pixels.assign(width * height, 0);
+			have.assign(chunks, false);
+		}
+		int offset = h.chunk * VISION_CHUNK_PAYLOAD;
+		if(have[h.chunk] || offset + len > (int)pixels.size())
+			return false;
+		memcpy(&pixels[offset], payload, len);
+		have[h.chunk] = true;
+		return ++received == chunks;
+	}
+};
+
+int main(int argc, char **argv)
+{
+	int port = VISION_PORT;
+	const char *frameDir = NULL;
+	long count = -1;
+	unsigned char buf[2048];
+	struct sockaddr_in addr;
+	FrameAssembler assemblers[256];
+	VisionResult r;
+	VisionFrameChunk h;
+	long results = 0, frames = 0, bad = 0;
+	unsigned long lastSeq[256];
+	bool seen[256] = {false};
+	int c, s, len;
+
+	while((c = getopt(argc, argv, "p:f:n:")) != -1)
+	{
+		switch(c)
+		{
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'f':
+			frameDir = optarg;
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: VisionReceiver [-p port] [-f dir] [-n count]\n");
+			return 2;
+		}
+	}
+
+	s = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if(s < 0 || bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		perror("VisionReceiver: bind");
+		return 2;
+	}
+	printf("VisionReceiver: listening on udp port %d\n", port);
+	fflush(stdout);
+
+	while(count < 0 || results < count)
+	{
+		len = recv(s, buf, sizeof(buf), 0);
+		if(len < 0)
+		{
+			perror("VisionReceiver: recv");
+			return 2;
+		}
+		if(r.Unpack(buf, len))
+		{
+			if(seen[r.camera] && r.seq != lastSeq[r.camera] + 1)
+				printf("# camera %d: %lu frame(s) missing\n", r.camera, r.seq - lastSeq[r.camera] - 1);
+			seen[r.camera] = true;
+			lastSeq[r.camera] = r.seq;
+			results++;
+			printf("cam %d %lu %.6f dist %.3f off %d thresh %d align %s track %d %dx%d rects %d",
+					r.camera, r.seq, r.timestamp / 1e6, r.distance / 1000.0, r.offset, r.threshold,
+					r.alignment < 4 ? ALIGNMENT[r.alignment] : "?", r.trackId,
+					r.imageWidth, r.imageHeight, r.rectCount);
+			for(int i = 0; i < r.rectCount; i++)
+				printf(" [%d,%d %dx%d]", r.rects[i].left, r.rects[i].top, r.rects[i].width, r.rects[i].height);
+			printf("\n");
+		}
+		else if(h.UnpackHeader(buf, len))
+		{
+			FrameAssembler &assembler = assemblers[h.camera];
+			if(assembler.Add(h, buf + VisionFrameChunk::HEADER_SIZE, len - VisionFrameChunk::HEADER_SIZE))
+			{
+				frames++;
+				printf("# frame cam %d %lu %dx%d\n", h.camera, h.seq, h.width, h.height);
+				if(frameDir)
+				{
+					char path[1024];
+					snprintf(path, sizeof(path), "%s/frame-%d-%lu.pgm", frameDir, h.camera, h.seq);
+					FILE *f = fopen(path, "wb");
+					if(f)
+					{
+						fprintf(f, "P5\n%d %d\n255\n", h.width, h.height);
+						fwrite(&assembler.pixels[0], 1, assembler.pixels.size(), f);
+						fclose(f);
+					}
+				}
+			}
+		}
+		else
+		{
+			bad++;
+		}
+		fflush(stdout);
+	}
+	printf("VisionReceiver: %ld results, %ld frames, %ld bad packets\n", results, frames, bad);
+	close(s);
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * $Id$
+ */
+
+#ifndef VISIONSCHEDULER_H
+#define VISIONSCHEDULER_H
+
+#include <vector>
+
+/*
+ * Decides which camera's frame a free vision worker takes next.
+ */
+
+static const double SCHED_FAIRNESS_SLACK = 0.05;   // weighted seconds a camera may run ahead
+
+/**
+ * Per-camera numbers since the last ClearStats().
+ */
+struct CameraStats
+{
+	long offered, served, dropped, late;
+	double busy;              // worker seconds
+	double latencySum, worstLatency;
+
+	CameraStats(): offered(0), served(0), dropped(0), late(0), busy(0), latencySum(0), worstLatency(0) {}
+};
+
+/**
+ * Holds the newest frame from each camera; an older one still waiting is
+ * handed back to the caller to free.  Next() serves the earliest latency
+ * deadline among the cameras that haven't run ahead of their share, where
+ * a camera's virtual time is the worker time it has had divided by its
+ * share.  Without that cap a camera with a tight target would starve the
+ * others whenever the pool is overloaded.  It never locks or waits; the
+ * caller does both around it.
+ */
+template <class F>
+class FrameScheduler
+{
+	struct Camera
+	{
+		double share;
+		double latencyTarget;
+		F *pending;
+		double captured;
+		int running;           // frames being worked on
+		double vtime;
+		CameraStats stats;
+	};
+	std::vector<Camera> cameras;
+
+	// lowest virtual time among the cameras with a frame waiting, or also
+	// those with one being worked on
+	bool MinVirtualTime(int except, bool running, double &v) const
+	{
+		bool any = false;
+		for(int i = 0; i < (int)cameras.size(); i++)
+		{
+			const Camera &c = cameras[i];
+			if(i == except || (!c.pending && !(running && c.running)))
+				continue;
+			if(!any || c.vtime < v)
+				v = c.vtime;
+			any = true;
+		}
+		return any;
+	}
+
+public:
+	int AddCamera(double share, double latencyTarget)
+	{
+		Camera c;
+		c.share = share;
+		c.latencyTarget = latencyTarget;
+		c.pending = 0;
+		c.captured = 0;
+		c.running = 0;
+		c.vtime = 0;
+		cameras.push_back(c);
+		return cameras.size() - 1;
+	}
+
+	int Cameras() const { return cameras.size(); }
+
+	/**
+	 * Queue a frame captured at the given time.  Returns the frame it
+	 * replaced, if any.
+	 */
+	F *Offer(int camera, F *frame, double captured)
+	{
+		Camera &c = cameras[camera];
+		F *old = c.pending;
+		double v = 0;
+		// an idle camera doesn't bank credit while it has nothing to do
+		if(!c.pending && !c.running && MinVirtualTime(camera, true, v) && c.vtime < v)
+			c.vtime = v;
+		c.pending = frame;
+		c.captured = captured;
+		c.stats.offered++;
+		if(old)
+			c.stats.dropped++;
+		return old;
+	}
+
+	/**
+	 * The frame to work on next, or NULL if none is waiting.
+	 */
+	F *Next(int &camera)
+	{
+		double floor = 0, deadline = 0;
+		int best = -1;
+		F *frame;
+		if(!MinVirtualTime(-1, false, floor))
+			return 0;
+		for(int i = 0; i < (int)cameras.size(); i++)
+		{
+			const Camera &c = cameras[i];
+			if(!c.pending || c.vtime > floor + SCHED_FAIRNESS_SLACK)
+				continue;
+			if(best < 0 || c.captured + c.latencyTarget < deadline)
+			{
+				best = i;
+				deadline = c.captured + c.latencyTarget;
+			}
+		}
+		if(best < 0)
+			return 0;
+		camera = best;
+		frame = cameras[best].pending;
+		cameras[best].pending = 0;
+		cameras[best].running++;
+		return frame;
+	}
+
+	/**
+	 * A worker finished a frame from camera after busy seconds, latency
+	 * seconds after it was captured.
+	 */
+	void Done(int camera, double busy, double latency)
+	{
+		Camera &c = cameras[camera];
+		c.running--;
+		c.vtime += busy / c.share;
+		c.stats.served++;
+		c.stats.busy += busy;
+		c.stats.latencySum += latency;
+		if(latency > c.stats.worstLatency)
+			c.stats.worstLatency = latency;
+		if(latency > c.latencyTarget)
+			c.stats.late++;
+	}
+
+	const CameraStats &Stats(int camera) const { return cameras[camera].stats; }
+	void ClearStats(int camera) { cameras[camera].stats = CameraStats(); }
+	double LatencyTarget(int camera) const { return cameras[camera].latencyTarget; }
+};
+
+#endif
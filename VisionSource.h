@@ -0,0 +1,126 @@
+/*
+ * $Id$
+ */
+
+#ifndef VISIONSOURCE_H
+#define VISIONSOURCE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+/*
+ * Where the vision pipeline gets its JPEGs.
+ */
+
+/**
+ * Same calls as AxisCamera's.
+ */
+class VisionSource
+{
+public:
+	virtual ~VisionSource() {}
+	virtual bool IsFreshImage() = 0;
+
+	/**
+	 * Copy the newest JPEG into *buf, reallocating it with new [] when it
+	 * is too small.  Returns the size, or 0 or less on failure.
+	 */
+	virtual int CopyJPEG(char **buf, int &size, int &bufferSize) = 0;
+};
+
+/**
+ * Width and height from a JPEG's start-of-frame marker.
+ */
+static inline bool JpegSize(const char *jpeg, int len, int &width, int &height)
+{
+	const unsigned char *p = (const unsigned char *)jpeg;
+	int i = 2;
+	if(len < 4 || p[0] != 0xff || p[1] != 0xd8)
+		return false;
+	while(i + 9 <= len)
+	{
+		int marker, segment;
+		if(p[i] != 0xff)
+			return false;
+		marker = p[i + 1];
+		segment = (p[i + 2] << 8) | p[i + 3];
+		// SOF0 to SOF15, minus DHT, JPG and DAC
+		if(marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc)
+		{
+			height = (p[i + 5] << 8) | p[i + 6];
+			width = (p[i + 7] << 8) | p[i + 8];
+			return true;
+		}
+		i += 2 + segment;
+	}
+	return false;
+}
+
+/**
+ * Plays back pattern % 0, pattern % 1, ... until a file is missing, at fps
+ * frames a second and looping at the end.  The files are read up front so
+ * playback costs no file I/O.
+ */
+class FileVisionSource : public VisionSource
+{
+	std::vector<std::vector<char> > frames;
+	double fps;
+	double (*clock)();
+	double start;
+	long served;
+
+	static const int MAX_FILES = 1000;
+
+public:
+	FileVisionSource(const char *pattern, double fps, double (*clock)()):
+		fps(fps),
+		clock(clock),
+		start(clock()),
+		served(-1)
+	{
+		char path[256];
+		for(int i = 0; i < MAX_FILES; i++)
+		{
+			FILE *f;
+			long len;
+			snprintf(path, sizeof(path), pattern, i);
+			if(!(f = fopen(path, "rb")))
+				break;
+			fseek(f, 0, SEEK_END);
+			len = ftell(f);
+			fseek(f, 0, SEEK_SET);
+			frames.push_back(std::vector<char>(len > 0 ? len : 1));
+			if(len <= 0 || fread(&frames.back()[0], len, 1, f) != 1)
+				frames.pop_back();
+			fclose(f);
+		}
+		printf("FileVisionSource: %d frames from %s\n", (int)frames.size(), pattern);
+	}
+
+	int Frames() const { return frames.size(); }
+
+	bool IsFreshImage()
+	{
+		return frames.size() && (long)((clock() - start) * fps) > served;
+	}
+
+	int CopyJPEG(char **buf, int &size, int &bufferSize)
+	{
+		if(!frames.size())
+			return 0;
+		served = (long)((clock() - start) * fps);
+		const std::vector<char> &frame = frames[served % frames.size()];
+		size = frame.size();
+		if(!*buf || bufferSize < size)
+		{
+			delete [] *buf;
+			bufferSize = size;
+			*buf = new char[bufferSize];
+		}
+		memcpy(*buf, &frame[0], size);
+		return size;
+	}
+};
+
+#endif